@@ -0,0 +1,44 @@
+#pragma once
+#include "combining_buffer.hpp"
+#include "hash_map.cpp"
+#include "sharded_hash_map.cpp"
+
+template <typename K, typename V, typename Combine, size_t N>
+combining_buffer<K, V, Combine, N>::combining_buffer(sharded_hash_map<K, V, N> &target, size_t flush_every,
+                                                     Combine combine)
+    : target_{target}, local_{1}, combine_{std::move(combine)}, threshold_{flush_every}
+{
+}
+
+template <typename K, typename V, typename Combine, size_t N> combining_buffer<K, V, Combine, N>::~combining_buffer()
+{
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+        // nothing useful to do with a failed drain here, and a destructor must not throw
+    }
+}
+
+template <typename K, typename V, typename Combine, size_t N>
+void combining_buffer<K, V, Combine, N>::add(const K &key, const V &delta)
+{
+    local_.upsert(key, [&]() -> const V & { return delta; }, [&](V &val) { val = combine_(std::move(val), delta); });
+    if (++pending_ >= threshold_)
+    {
+        flush();
+    }
+}
+
+// local_ keeps its capacity, the same hot keys usually come back before the next flush
+template <typename K, typename V, typename Combine, size_t N> void combining_buffer<K, V, Combine, N>::flush()
+{
+    if (pending_ == 0)
+    {
+        return;
+    }
+    target_.merge_from(local_, [&](V &shared, V &local) { shared = combine_(std::move(shared), std::move(local)); });
+    pending_ = 0;
+}
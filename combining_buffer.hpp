@@ -0,0 +1,31 @@
+#pragma once
+#include "hash_map.hpp"
+#include "sharded_hash_map.hpp"
+#include <cstddef>
+#include <functional>
+
+// per-thread front for a shared sharded_hash_map that is updated far more often than it is read,
+// such as hot-key counters: updates to the same key are combined in a private hash_map and
+// folded into the shared map by flush(), which locks each shard it touches once
+// one buffer belongs to one thread, the shared map only sees updates that have been flushed
+template <typename K, typename V, typename Combine = std::plus<V>, size_t N = 64> class combining_buffer
+{
+    sharded_hash_map<K, V, N> &target_;
+    hash_map<K, V> local_;
+    Combine combine_;
+    size_t threshold_;
+    size_t pending_{0}; // updates since the last flush
+
+  public:
+    // constructors
+    // flushes every flush_every updates, which bounds both how stale the shared map gets and local_'s size
+    combining_buffer(sharded_hash_map<K, V, N> &target, size_t flush_every = 4096, Combine combine = {});
+    combining_buffer(const combining_buffer &) = delete;
+    combining_buffer &operator=(const combining_buffer &) = delete;
+    ~combining_buffer(); // drains whatever is left, call flush() first to see its exceptions
+
+    void add(const K &key, const V &delta); // local value = combine(local value, delta)
+    void flush();
+
+    size_t pending() const { return pending_; }
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include "concurrent_insert_map.hpp"
+#include "hash_map.cpp"
+#include <cstring>
+#include <stdexcept>
+
+template <typename K, typename V> size_t concurrent_insert_map<K, V>::groups_for(size_t max_size)
+{
+    size_t groups = 1;
+    while (max_size > map_t::max_load(groups * map_t::k_group_size_))
+    {
+        groups *= 2;
+    }
+    return groups;
+}
+
+template <typename K, typename V>
+concurrent_insert_map<K, V>::concurrent_insert_map(size_t max_size, alloc_policy policy)
+    : map_{groups_for(max_size), policy}, max_load_{map_t::max_load(map_.capacity_)}
+{
+}
+
+// group is a snapshot of control bytes, a byte that matched is loaded again with acquire so the slot
+// it published is visible before it is read, published bytes never change again
+template <typename K, typename V>
+size_t concurrent_insert_map<K, V>::find_in_group(ctrl_t &group, size_t group_idx, const K &key, size_t hash) const
+{
+    uint16_t ctrl_mask = match(group, map_t::H2(hash));
+    while (ctrl_mask != 0)
+    {
+        size_t slot_idx = (group_idx * map_t::k_group_size_) + __builtin_ctz(ctrl_mask);
+        std::atomic_ref<uint8_t>{map_.ctrls[group_idx][slot_idx % map_t::k_group_size_]}.load(
+            std::memory_order_acquire);
+        const slot_t &slot = map_.slots[slot_idx];
+        if constexpr (Arithmetic<K>)
+        {
+            if (slot.data.first == key)
+            {
+                return slot_idx;
+            }
+        }
+        else
+        {
+            if (slot.hash == hash && slot.data.first == key)
+            {
+                return slot_idx;
+            }
+        }
+        ctrl_mask &= (ctrl_mask - 1); // clear lowest set bit
+    }
+    return map_t::k_npos_;
+}
+
+// every decision for a group is made from one snapshot of it, and a byte only moves from Empty to Busy
+// to filled, so if two writers race on the same key the later snapshot sees the other's Busy or H2
+// byte, either in the same group or in one the earlier writer found full and skipped
+template <typename K, typename V> bool concurrent_insert_map<K, V>::insert(const K &key, const V &val)
+{
+    size_t hash = map_t::hash_key(key);
+    size_t group_idx = map_t::H1(hash) & map_.mask_;
+
+    while (true)
+    {
+        ctrl_t group;
+        std::memcpy(group, map_.ctrls[group_idx], sizeof(ctrl_t));
+        if (find_in_group(group, group_idx, key, hash) != map_t::k_npos_)
+        {
+            return false;
+        }
+        if (match(group, Busy) != 0)
+        {
+            _mm_pause(); // another writer is publishing a slot here, it may be this key
+            continue;
+        }
+        uint16_t empty_mask = match(group, Empty);
+        if (empty_mask == 0)
+        {
+            group_idx = (group_idx + 1) & map_.mask_;
+            continue;
+        }
+
+        // the first Empty byte of the snapshot, the CAS fails if any writer got there first
+        int offset = __builtin_ctz(empty_mask);
+        std::atomic_ref<uint8_t> ctrl_byte{map_.ctrls[group_idx][offset]};
+        uint8_t expected = Empty;
+        if (!ctrl_byte.compare_exchange_strong(expected, Busy, std::memory_order_acquire))
+        {
+            continue;
+        }
+        // counted only once claimed, the load factor keeps an Empty byte in every probe sequence
+        if (size_.fetch_add(1, std::memory_order_relaxed) >= max_load_)
+        {
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            ctrl_byte.store(Empty, std::memory_order_release);
+            throw std::length_error("concurrent_insert_map is full");
+        }
+        try
+        {
+            if constexpr (Arithmetic<K>)
+            {
+                ::new (&map_.slots[(group_idx * map_t::k_group_size_) + offset]) slot_t{key, val};
+            }
+            else
+            {
+                ::new (&map_.slots[(group_idx * map_t::k_group_size_) + offset]) slot_t{key, val, hash};
+            }
+        }
+        catch (...)
+        {
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            ctrl_byte.store(Empty, std::memory_order_release);
+            throw;
+        }
+        ctrl_byte.store(map_t::H2(hash), std::memory_order_release);
+        return true;
+    }
+}
+
+// Busy bytes are neither a match nor Empty, so a reader probes past a slot that is still being written
+template <typename K, typename V> const V *concurrent_insert_map<K, V>::get_if(const K &key) const
+{
+    size_t hash = map_t::hash_key(key);
+    size_t group_idx = map_t::H1(hash) & map_.mask_;
+
+    while (true)
+    {
+        ctrl_t group;
+        std::memcpy(group, map_.ctrls[group_idx], sizeof(ctrl_t));
+        size_t slot_idx = find_in_group(group, group_idx, key, hash);
+        if (slot_idx != map_t::k_npos_)
+        {
+            return &map_.slots[slot_idx].data.second;
+        }
+        if (match(group, Empty) != 0)
+        {
+            return nullptr;
+        }
+        group_idx = (group_idx + 1) & map_.mask_;
+    }
+}
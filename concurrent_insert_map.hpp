@@ -0,0 +1,38 @@
+#pragma once
+#include "hash_map.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// insert-only hash_map that any number of threads can insert into and read from without locks
+// the table is sized once for the number of elements it will hold and never grows or erases,
+// a writer claims a slot by CAS on its control byte from Empty to Busy, constructs the slot and then
+// publishes it by storing H2 with release, readers match control bytes exactly as hash_map does
+// a writer that sees a Busy byte in a group it has to check waits for it, as it may hold the same key
+template <typename K, typename V> class concurrent_insert_map
+{
+    using map_t = hash_map<K, V>;
+    using slot_t = typename map_t::slot_t;
+    using ctrl_t = typename map_t::ctrl_t;
+
+    static constexpr size_t k_cache_line_{64};
+
+    map_t map_;
+    size_t max_load_;
+    alignas(k_cache_line_) std::atomic<size_t> size_{0};
+
+    static size_t groups_for(size_t max_size);
+    size_t find_in_group(ctrl_t &group, size_t group_idx, const K &key, size_t hash) const;
+
+  public:
+    // constructors
+    concurrent_insert_map(size_t max_size, alloc_policy policy = {});
+
+    // safe to call from any number of threads at once
+    bool insert(const K &key, const V &val); // false if the key was already present
+    const V *get_if(const K &key) const;     // stays valid for the life of the map
+    bool contains(const K &key) const { return get_if(key) != nullptr; }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    size_t max_size() const { return max_load_; }
+};
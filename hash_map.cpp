@@ -1,31 +1,525 @@
+#pragma once
 #include "hash_map.hpp"
 #include "rapidhash.h"
 #include "sse2neon.h" // this is for apple sillicon, otherwise use emmintrin
 // #include <emmintrin.h>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <exception>
 #include <new> // IWYU pragma: keep (placement new for c++23 >= compilation)
 #include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <bit>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+constexpr size_t k_huge_page_size{size_t{2} << 20}; // 2MB
+
+// only tables of at least one huge page are mapped, smaller ones stay on the heap
+inline bool is_mapped(size_t bytes, const alloc_policy &policy)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    return (policy.pages == page_policy::Huge || policy.numa != numa_policy::Local) && bytes >= k_huge_page_size;
+#else
+    return false;
+#endif
+}
+
+inline size_t round_to_huge_page(size_t bytes)
+{
+    return (bytes + k_huge_page_size - 1) & ~(k_huge_page_size - 1);
+}
+
+#ifdef __linux__
+// bitmask of online numa nodes, parsed once from sysfs e.g. "0-1,3"
+inline uint64_t online_nodes()
+{
+    static const uint64_t nodes = [] {
+        uint64_t mask = 0;
+        std::ifstream file("/sys/devices/system/node/online");
+        std::string range;
+        while (std::getline(file, range, ','))
+        {
+            size_t dash = range.find('-');
+            int first = std::stoi(range);
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int node = first; node <= last && node < 64; node++)
+            {
+                mask |= uint64_t{1} << node;
+            }
+        }
+        return mask;
+    }();
+    return nodes;
+}
+#endif
+
+// must run before the pages are first touched, single node machines keep the default placement
+inline void place_table(void *ptr, size_t len, const alloc_policy &policy)
+{
+#ifdef __linux__
+    uint64_t nodes = online_nodes();
+    if (policy.numa == numa_policy::Local || std::popcount(nodes) <= 1)
+    {
+        return;
+    }
+    int mode = MPOL_INTERLEAVE;
+    if (policy.numa == numa_policy::Bind)
+    {
+        if (policy.numa_node < 0 || policy.numa_node >= 64 || (nodes >> policy.numa_node & 1) == 0)
+        {
+            return;
+        }
+        mode = MPOL_BIND;
+        nodes = uint64_t{1} << policy.numa_node;
+    }
+    unsigned long node_mask = nodes;
+    syscall(SYS_mbind, ptr, len, mode, &node_mask, sizeof(node_mask) * 8 + 1, 0); // a failure keeps first touch
+#else
+    (void)ptr, (void)len, (void)policy;
+#endif
+}
+
+// uninitialised table memory unless zeroed, falls back silently to regular pages when huge pages are unavailable
+// mapped memory is always zeroed by the kernel, pages are only faulted in once written
+inline void *table_alloc(size_t bytes, const alloc_policy &policy, bool zeroed = false)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (is_mapped(bytes, policy))
+    {
+        size_t len = round_to_huge_page(bytes);
+#ifdef MAP_HUGETLB
+        // explicit huge pages only succeed when the administrator has reserved a pool
+        if (policy.pages == page_policy::Huge)
+        {
+            void *huge = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (huge != MAP_FAILED)
+            {
+                place_table(huge, len, policy);
+                return huge;
+            }
+        }
+#endif
+        // over-map by one huge page, then trim the head and tail so the table is 2MB aligned
+        void *raw = mmap(nullptr, len + k_huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        auto addr = reinterpret_cast<uintptr_t>(raw);
+        size_t head = ((addr + k_huge_page_size - 1) & ~(k_huge_page_size - 1)) - addr;
+        if (head != 0)
+        {
+            munmap(raw, head);
+        }
+        if (head != k_huge_page_size)
+        {
+            munmap(static_cast<char *>(raw) + head + len, k_huge_page_size - head);
+        }
+        void *ptr = static_cast<char *>(raw) + head;
+#ifdef MADV_HUGEPAGE
+        if (policy.pages == page_policy::Huge)
+        {
+            madvise(ptr, len, MADV_HUGEPAGE); // transparent huge pages, a hint only
+        }
+#endif
+        place_table(ptr, len, policy);
+        return ptr;
+    }
+#endif
+    void *ptr = zeroed ? std::calloc(bytes, 1) : std::malloc(bytes);
+    if (ptr == nullptr && bytes != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+inline void table_free(void *ptr, size_t bytes, const alloc_policy &policy)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    if (is_mapped(bytes, policy))
+    {
+        munmap(ptr, round_to_huge_page(bytes));
+        return;
+    }
+#endif
+    std::free(ptr);
+}
+
+// reset table memory to zero, mapped tables hand their pages back so they become untouched zero pages again
+inline void table_zero(void *ptr, size_t bytes, const alloc_policy &policy)
+{
+#ifdef __linux__
+    if (is_mapped(bytes, policy) && madvise(ptr, round_to_huge_page(bytes), MADV_DONTNEED) == 0)
+    {
+        return;
+    }
+#endif
+    std::memset(ptr, 0, bytes);
+}
+
+// hand back the whole pages inside [begin, end) once their contents are dead, the memory stays allocated
+// and reads as zero, so freeing the table later has fewer resident pages to tear down
+// returns where the next discard should start, the partial page at the end is left for it
+inline void *table_discard(void *begin, void *end)
+{
+#ifdef __linux__
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1);
+    uintptr_t last = reinterpret_cast<uintptr_t>(end) & ~(page - 1);
+    if (first < last)
+    {
+        madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+        return reinterpret_cast<void *>(last);
+    }
+#else
+    (void)end;
+#endif
+    return begin;
+}
+
+// run fn(0) to fn(threads - 1) at once with fn(0) on the calling thread, then rethrow the first exception
+// any of them threw once all are done, a thread that fails to start has its share run here instead
+template <typename F> void run_threads(size_t threads, F &&fn)
+{
+    std::vector<std::exception_ptr> errors(threads);
+    auto guarded = [&](size_t t) {
+        try
+        {
+            fn(t);
+        }
+        catch (...)
+        {
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t t = 1; t < threads; t++)
+    {
+        try
+        {
+            workers.emplace_back(guarded, t);
+        }
+        catch (const std::system_error &)
+        {
+            guarded(t);
+        }
+    }
+    guarded(0);
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    for (auto &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+inline uint16_t match(uint8_t *group, uint8_t ctrl_byte)
+{
+    __m128i ctrl = _mm_loadu_si128((__m128i *)group); // load group into register
+    __m128i match = _mm_set1_epi8(ctrl_byte);         // create mask of control byte
+    __m128i cmp = _mm_cmpeq_epi8(ctrl, match);        // compare both 16 byte 'arrays' simultaneously
+    return _mm_movemask_epi8(cmp);                    // compress to a 16bit integer 1 - match, 0 - miss
+}
+
+inline uint16_t match_filled(uint8_t *group)
+{
+    // filled control bytes are the only ones with the MSB set, Empty and Tombstone have it clear
+    // movemask_epi8 extracts the MSB of all 16 bytes, 1 - filled, 0 - empty or tombstone
+    return _mm_movemask_epi8(_mm_loadu_si128((__m128i *)group));
+}
+
+template <typename K, typename V>
+hash_map<K, V>::hash_map(size_t num_groups, alloc_policy policy)
+    : groups_{num_groups}, capacity_{k_group_size_ * num_groups}, mask_{num_groups - 1}, policy_{policy}
+{
+    allocate();
+}
+
+// trivially copyable slots are copied wholesale, otherwise only live slots are copy constructed
+// either way nothing is rehashed, the copy keeps the same layout as other
+template <typename K, typename V>
+hash_map<K, V>::hash_map(const hash_map &other)
+    : capacity_{other.capacity_}, groups_{other.groups_}, mask_{other.mask_}, policy_{other.policy_}
+{
+    if (other.capacity_ == 0)
+    {
+        reset_empty();
+        return;
+    }
+    allocate();
+    if constexpr (std::is_trivially_copy_constructible_v<slot_t> && std::is_trivially_destructible_v<slot_t>)
+    {
+        std::memcpy(static_cast<void *>(slots), other.slots, capacity_ * sizeof(slot_t));
+        std::memcpy(ctrls, other.ctrls, groups_ * sizeof(ctrl_t));
+    }
+    else
+    {
+        try
+        {
+            for (size_t gi = 0; gi < groups_; gi++)
+            {
+                uint16_t filled = match_filled(other.ctrls[gi]);
+                while (filled != 0)
+                {
+                    int offset = __builtin_ctz(filled);
+                    size_t slot_idx = (gi * k_group_size_) + offset;
+                    ::new (&slots[slot_idx]) slot_t{other.slots[slot_idx]};
+                    ctrls[gi][offset] = other.ctrls[gi][offset];
+                    filled &= (filled - 1);
+                }
+            }
+        }
+        catch (...)
+        {
+            destroy_slots();
+            deallocate(slots, ctrls, groups_);
+            throw;
+        }
+        std::memcpy(ctrls, other.ctrls, groups_ * sizeof(ctrl_t)); // tombstones
+    }
+    size_ = other.size_;
+    used_ = other.used_;
+}
 
 template <typename K, typename V>
-hash_map<K, V>::hash_map(size_t num_groups)
-    : groups_{num_groups}, capacity_{k_group_size_ * num_groups}, mask_{num_groups - 1}
+hash_map<K, V>::hash_map(hash_map &&other) noexcept
+    : slots{other.slots}, ctrls{other.ctrls}, capacity_{other.capacity_}, groups_{other.groups_}, mask_{other.mask_},
+      size_{other.size_}, used_{other.used_}, policy_{other.policy_}
+{
+    other.reset_empty();
+}
+
+template <typename K, typename V> hash_map<K, V> &hash_map<K, V>::operator=(hash_map other) noexcept
+{
+    swap(other);
+    return *this;
+}
+
+template <typename K, typename V> void hash_map<K, V>::swap(hash_map &other) noexcept
 {
-    slots = new slot_t[capacity_]{};
-    ctrls = new ctrl_t[groups_]{};
-    std::memset(ctrls, Empty, groups_ * k_group_size_);
+    std::swap(slots, other.slots);
+    std::swap(ctrls, other.ctrls);
+    std::swap(capacity_, other.capacity_);
+    std::swap(groups_, other.groups_);
+    std::swap(mask_, other.mask_);
+    std::swap(size_, other.size_);
+    std::swap(used_, other.used_);
+    std::swap(policy_, other.policy_);
 }
 
 template <typename K, typename V> hash_map<K, V>::~hash_map()
 {
-    delete[] slots;
-    delete[] ctrls;
+    destroy_slots();
+    deallocate(slots, ctrls, groups_);
 }
 
-template <typename K, typename V> inline size_t hash_map<K, V>::hash_key(const K &key) const
+template <typename K, typename V> typename hash_map<K, V>::node_type hash_map<K, V>::extract(const K &key)
 {
-    // Use concepts to determine how to hash key, will be decided at compile time
+    node_type node;
+    size_t slot_idx = find_slot(key, hash_key(key));
+    if (slot_idx != k_npos_)
+    {
+        node.slot_.emplace(std::move(slots[slot_idx]));
+        erase_slot(slot_idx);
+    }
+    return node;
+}
+
+// returns false and leaves node untouched if the key is already present
+template <typename K, typename V> bool hash_map<K, V>::insert(node_type &&node)
+{
+    if (node.empty())
+    {
+        return false;
+    }
+    size_t hash;
     if constexpr (Arithmetic<K>)
+    {
+        hash = hash_key(node.key());
+    }
+    else
+    {
+        hash = node.slot_->hash;
+    }
+    auto [slot_idx, inserted] = find_or_prepare_insert(node.key(), hash);
+    if (inserted)
+    {
+        construct(slot_idx, node.key(), [&] { return std::move(node.mapped()); }, hash);
+        node.slot_.reset();
+    }
+    return inserted;
+}
+
+// moves every element whose key is not already present out of other, reusing stored hashes
+// other is swept in group order, so when both tables share a capacity the destination groups
+// are visited in the same ascending order and both tables stream through the cache together
+template <typename K, typename V> void hash_map<K, V>::merge(hash_map &other)
+{
+    if (&other == this)
+    {
+        return;
+    }
+    reserve(size_ + other.size_);
+    for (size_t gi = 0; gi < other.groups_; gi++)
+    {
+        uint16_t filled = match_filled(other.ctrls[gi]);
+        while (filled != 0)
+        {
+            size_t other_idx = (gi * k_group_size_) + __builtin_ctz(filled);
+            auto &slot_data = other.slots[other_idx];
+            size_t hash;
+            if constexpr (Arithmetic<K>)
+            {
+                hash = hash_key(slot_data.data.first);
+            }
+            else
+            {
+                hash = slot_data.hash;
+            }
+            auto [slot_idx, inserted] = find_or_prepare_insert(slot_data.data.first, hash);
+            if (inserted)
+            {
+                construct(slot_idx, slot_data.data.first, [&] { return std::move(slot_data.data.second); }, hash);
+                other.erase_slot(other_idx);
+            }
+            filled &= (filled - 1);
+        }
+    }
+}
+
+// keeps the allocation unless release is set, then the table goes back to the default capacity
+template <typename K, typename V> void hash_map<K, V>::clear(bool release)
+{
+    if (capacity_ == 0)
+    {
+        return;
+    }
+    destroy_slots();
+    size_ = 0;
+    used_ = 0;
+    if (release)
+    {
+        deallocate(slots, ctrls, groups_);
+        reset_empty(); // if the allocation below throws the map is left empty rather than dangling
+        groups_ = k_default_capacity_;
+        capacity_ = k_group_size_ * groups_;
+        mask_ = groups_ - 1;
+        try
+        {
+            allocate();
+        }
+        catch (...)
+        {
+            if (slots != nullptr)
+            {
+                table_free(slots, capacity_ * sizeof(slot_t), policy_); // the control bytes failed
+            }
+            reset_empty();
+            throw;
+        }
+        return;
+    }
+    table_zero(ctrls, groups_ * sizeof(ctrl_t), policy_); // all Empty
+}
+
+// no slots and a single shared Empty group, the next insert sees a full table and resizes
+template <typename K, typename V> void hash_map<K, V>::reset_empty() noexcept
+{
+    slots = nullptr;
+    ctrls = &empty_group_;
+    capacity_ = 0;
+    groups_ = 1;
+    mask_ = 0;
+    size_ = 0;
+    used_ = 0;
+}
+
+// slots are left uninitialised, only slots with a filled control byte hold a live object
+template <typename K, typename V> void hash_map<K, V>::allocate()
+{
+    static_assert(alignof(slot_t) <= alignof(std::max_align_t), "over-aligned slots are not supported");
+    slots = static_cast<slot_t *>(table_alloc(capacity_ * sizeof(slot_t), policy_));
+    ctrls = static_cast<ctrl_t *>(table_alloc(groups_ * sizeof(ctrl_t), policy_, true)); // all Empty
+}
+
+template <typename K, typename V>
+void hash_map<K, V>::deallocate(slot_t *old_slots, ctrl_t *old_ctrls, size_t old_groups)
+{
+    table_free(old_slots, old_groups * k_group_size_ * sizeof(slot_t), policy_);
+    if (old_ctrls != &empty_group_)
+    {
+        table_free(old_ctrls, old_groups * sizeof(ctrl_t), policy_);
+    }
+}
+
+template <typename K, typename V> void hash_map<K, V>::destroy_slots()
+{
+    if constexpr (!std::is_trivially_destructible_v<slot_t>)
+    {
+        for (size_t gi = 0; gi < groups_; gi++)
+        {
+            uint16_t filled = match_filled(ctrls[gi]);
+            while (filled != 0)
+            {
+                slots[(gi * k_group_size_) + __builtin_ctz(filled)].~slot_t();
+                filled &= (filled - 1);
+            }
+        }
+    }
+}
+
+// advance to the next filled slot, checking a whole group of control bytes per step
+template <typename K, typename V> template <bool Const> void hash_map<K, V>::iter<Const>::skip_empty()
+{
+    while (filled_ == 0 && ++group_ < map_->groups_)
+    {
+        filled_ = match_filled(map_->ctrls[group_]);
+    }
+}
+
+template <typename K, typename V> typename hash_map<K, V>::iterator hash_map<K, V>::begin()
+{
+    iterator it{this, 0, match_filled(ctrls[0])};
+    it.skip_empty();
+    return it;
+}
+
+template <typename K, typename V> typename hash_map<K, V>::const_iterator hash_map<K, V>::begin() const
+{
+    const_iterator it{this, 0, match_filled(ctrls[0])};
+    it.skip_empty();
+    return it;
+}
+
+template <typename K, typename V> template <typename Q> inline size_t hash_map<K, V>::hash_key(const Q &key)
+{
+    // Use concepts to determine how to hash key, will be decided at compile time
+    if constexpr (Arithmetic<Q>)
     {
         // SplitMix64 finalizer - mixes bits to improve hash distribution
         // See: https://prng.di.unimi.it/splitmix64.c
@@ -38,27 +532,36 @@ template <typename K, typename V> inline size_t hash_map<K, V>::hash_key(const K
         hash ^= hash >> kMixShift;
         return hash;
     }
-    else if constexpr (Container<K>)
+    else if constexpr (Container<Q>)
     {
         return rapidhash(key.data(), key.size() * sizeof(*key.data()));
     }
-    else if constexpr (Copyable<K>)
+    else if constexpr (Copyable<Q>)
     {
-        return rapidhash(&key, sizeof(K));
+        return rapidhash(&key, sizeof(Q));
     }
 }
 
-inline uint16_t match(uint8_t *group, uint8_t ctrl_byte)
+// first Empty slot on the probe sequence, used when the key is known not to be in the table
+template <typename K, typename V> size_t hash_map<K, V>::find_empty(size_t hash) const
 {
-    __m128i ctrl = _mm_loadu_si128((__m128i *)group); // load group into register
-    __m128i match = _mm_set1_epi8(ctrl_byte);         // create mask of control byte
-    __m128i cmp = _mm_cmpeq_epi8(ctrl, match);        // compare both 16 byte 'arrays' simultaneously
-    return _mm_movemask_epi8(cmp);                    // compress to a 16bit integer 1 - match, 0 - miss
+    size_t group_idx = H1(hash) & mask_;
+    while (true)
+    {
+        uint16_t empty_mask = match(ctrls[group_idx], Empty);
+        if (empty_mask != 0)
+        {
+            return (group_idx * k_group_size_) + __builtin_ctz(empty_mask);
+        }
+        group_idx = (group_idx + 1) & mask_;
+    }
 }
 
-template <typename K, typename V> void hash_map<K, V>::insert(const K &key, const V &val)
+// probe once for key, on a miss claim a slot for it and return {slot, true}, the caller then constructs the slot
+// re-size before claiming if the insert would go above load factor, so the returned slot is never moved
+template <typename K, typename V>
+std::pair<size_t, bool> hash_map<K, V>::find_or_prepare_insert(const K &key, size_t hash)
 {
-    size_t hash = hash_key(key);
     size_t group_idx = H1(hash) & mask_;
     uint8_t ctrl_byte = H2(hash);
 
@@ -76,16 +579,14 @@ template <typename K, typename V> void hash_map<K, V>::insert(const K &key, cons
             {
                 if (slots[slot_idx].data.first == key)
                 {
-                    slots[slot_idx].data.second = val;
-                    return;
+                    return {slot_idx, false};
                 }
             }
             else
             {
                 if (slots[slot_idx].hash == hash && slots[slot_idx].data.first == key)
                 {
-                    slots[slot_idx].data.second = val;
-                    return;
+                    return {slot_idx, false};
                 }
             }
 
@@ -95,42 +596,401 @@ template <typename K, typename V> void hash_map<K, V>::insert(const K &key, cons
         uint16_t empty_mask = match(group, Empty);
         if (empty_mask != 0)
         {
-            int offset = __builtin_ctz(empty_mask);
-            group[offset] = ctrl_byte;
-            size_t slot_idx = (group_idx * k_group_size_) + offset;
-            if constexpr (Arithmetic<K>)
-            {
-                new (&slots[slot_idx]) slot_t{key, val};
-            }
-            else
+            size_t slot_idx = (group_idx * k_group_size_) + __builtin_ctz(empty_mask);
+            if (used_ + 1 > max_load(capacity_))
             {
-                ::new (&slots[slot_idx]) slot_t{key, val, hash};
+                resize(groups_ * 2);
+                slot_idx = find_empty(hash);
             }
+            ctrls[slot_idx / k_group_size_][slot_idx % k_group_size_] = ctrl_byte;
             size_++;
             used_++;
-            if (at_max_load())
+            return {slot_idx, true};
+        }
+        group_idx = (group_idx + 1) & mask_;
+    }
+}
+
+// construct a slot claimed by find_or_prepare_insert from the value make() returns
+// if make or the constructor throws the claim is released
+template <typename K, typename V>
+template <typename Make>
+void hash_map<K, V>::construct(size_t slot_idx, const K &key, Make &&make, size_t hash)
+{
+    try
+    {
+        if constexpr (Arithmetic<K>)
+        {
+            ::new (&slots[slot_idx]) slot_t{key, make()};
+        }
+        else
+        {
+            ::new (&slots[slot_idx]) slot_t{key, make(), hash};
+        }
+    }
+    catch (...)
+    {
+        ctrls[slot_idx / k_group_size_][slot_idx % k_group_size_] = Tombstone;
+        size_--;
+        throw;
+    }
+}
+
+template <typename K, typename V> void hash_map<K, V>::insert(const K &key, const V &val, size_t hash)
+{
+    auto [slot_idx, inserted] = find_or_prepare_insert(key, hash);
+    if (!inserted)
+    {
+        slots[slot_idx].data.second = val;
+        return;
+    }
+    construct(slot_idx, key, [&]() -> const V & { return val; }, hash);
+}
+
+template <typename K, typename V> void hash_map<K, V>::insert(const K &key, const V &val)
+{
+    insert(key, val, hash_key(key));
+}
+
+template <typename K, typename V> V &hash_map<K, V>::operator[](const K &key)
+{
+    size_t hash = hash_key(key);
+    auto [slot_idx, inserted] = find_or_prepare_insert(key, hash);
+    if (inserted)
+    {
+        construct(slot_idx, key, [] { return V{}; }, hash);
+    }
+    return slots[slot_idx].data.second;
+}
+
+// one hash and one probe, update runs in place on a hit, on a miss the value is built straight from make()
+template <typename K, typename V>
+template <typename Make, typename Update>
+V &hash_map<K, V>::upsert(const K &key, Make &&make, Update &&update)
+{
+    return upsert(key, hash_key(key), std::forward<Make>(make), std::forward<Update>(update));
+}
+
+template <typename K, typename V>
+template <typename Make, typename Update>
+V &hash_map<K, V>::upsert(const K &key, size_t hash, Make &&make, Update &&update)
+{
+    auto [slot_idx, inserted] = find_or_prepare_insert(key, hash);
+    if (inserted)
+    {
+        construct(slot_idx, key, std::forward<Make>(make), hash);
+    }
+    else
+    {
+        std::forward<Update>(update)(slots[slot_idx].data.second);
+    }
+    return slots[slot_idx].data.second;
+}
+
+// one hash and one probe, fn gets the existing value or nullptr and returns the value to store
+// on a miss its result is constructed straight into the slot, so V need not be default constructible
+template <typename K, typename V>
+template <typename F>
+V &hash_map<K, V>::compute(const K &key, F &&fn)
+{
+    size_t hash = hash_key(key);
+    auto [slot_idx, inserted] = find_or_prepare_insert(key, hash);
+    if (inserted)
+    {
+        construct(slot_idx, key, [&] { return std::forward<F>(fn)(static_cast<V *>(nullptr)); }, hash);
+    }
+    else
+    {
+        V &val = slots[slot_idx].data.second;
+        val = std::forward<F>(fn)(&val);
+    }
+    return slots[slot_idx].data.second;
+}
+
+// grow once so that n elements fit without another resize
+template <typename K, typename V> void hash_map<K, V>::reserve(size_t n)
+{
+    size_t needed = used_ + (n > size_ ? n - size_ : 0);
+    size_t new_groups = groups_;
+    while (needed > max_load(new_groups * k_group_size_))
+    {
+        new_groups *= 2;
+    }
+    if (new_groups != groups_)
+    {
+        resize(new_groups);
+    }
+}
+
+// one reservation for the whole batch, then hash a block of keys and prefetch their
+// destination groups before placing any of them
+template <typename K, typename V> void hash_map<K, V>::insert_batch(std::span<const K> keys, std::span<const V> vals)
+{
+    reserve(size_ + keys.size());
+    size_t hashes[k_batch_size_];
+
+    for (size_t base = 0; base < keys.size(); base += k_batch_size_)
+    {
+        size_t n = std::min(k_batch_size_, keys.size() - base);
+        for (size_t i = 0; i < n; i++)
+        {
+            hashes[i] = hash_key(keys[base + i]);
+            __builtin_prefetch(ctrls[H1(hashes[i]) & mask_], 1);
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            insert(keys[base + i], vals[base + i], hashes[i]);
+        }
+    }
+}
+
+// place the inputs order[] lists, all homed in groups before group_end, without leaving those groups
+// no other thread writes this range, so slots are constructed before their control byte is set and nothing
+// needs undoing if a constructor throws, inputs that would probe past group_end go to spills
+// returns the number of slots filled
+template <typename K, typename V>
+size_t hash_map<K, V>::fill_range(std::span<const K> keys, std::span<const V> vals, std::span<const size_t> order,
+                                  const size_t *hashes, size_t group_end, std::vector<size_t> &spills)
+{
+    size_t filled = 0;
+    for (size_t idx : order)
+    {
+        size_t hash = hashes[idx];
+        size_t group_idx = H1(hash) & mask_;
+        uint8_t ctrl_byte = H2(hash);
+        while (true)
+        {
+            auto &group = ctrls[group_idx];
+            uint16_t ctrl_mask = match(group, ctrl_byte);
+            size_t found = k_npos_;
+            while (ctrl_mask != 0 && found == k_npos_)
+            {
+                size_t slot_idx = (group_idx * k_group_size_) + __builtin_ctz(ctrl_mask);
+                if constexpr (Arithmetic<K>)
+                {
+                    found = slots[slot_idx].data.first == keys[idx] ? slot_idx : k_npos_;
+                }
+                else
+                {
+                    found = slots[slot_idx].hash == hash && slots[slot_idx].data.first == keys[idx] ? slot_idx : k_npos_;
+                }
+                ctrl_mask &= (ctrl_mask - 1);
+            }
+            if (found != k_npos_)
+            {
+                slots[found].data.second = vals[idx]; // a later duplicate wins, as with insert
+                break;
+            }
+            uint16_t empty_mask = match(group, Empty);
+            if (empty_mask != 0)
             {
-                resize();
+                int offset = __builtin_ctz(empty_mask);
+                if constexpr (Arithmetic<K>)
+                {
+                    ::new (&slots[(group_idx * k_group_size_) + offset]) slot_t{keys[idx], vals[idx]};
+                }
+                else
+                {
+                    ::new (&slots[(group_idx * k_group_size_) + offset]) slot_t{keys[idx], vals[idx], hash};
+                }
+                group[offset] = ctrl_byte;
+                filled++;
+                break;
+            }
+            if (++group_idx == group_end)
+            {
+                spills.push_back(idx);
+                break;
+            }
+        }
+    }
+    return filled;
+}
+
+// bulk build on several threads, the table is sized for every input up front and then
+// 1. each thread hashes a chunk of the inputs and counts how many fall in each partition
+// 2. each thread scatters the indices of its chunk into partition order, keeping input order within a partition
+// 3. each thread fills the contiguous group range of one partition, no two threads write the same groups
+// 4. inputs whose probe ran off the end of their range are inserted on the calling thread
+// a partition is the top bits of the home group, so all copies of a key land in the same one and the
+// last copy wins like insert_batch, small inputs go straight to insert_batch
+template <typename K, typename V>
+hash_map<K, V> hash_map<K, V>::build_parallel(std::span<const K> keys, std::span<const V> vals, unsigned threads,
+                                              alloc_policy policy)
+{
+    size_t n = keys.size();
+    size_t groups = 1;
+    while (n > max_load(groups * k_group_size_))
+    {
+        groups *= 2;
+    }
+    hash_map map{groups, policy};
+
+    size_t parts = threads != 0 ? threads : std::thread::hardware_concurrency();
+    parts = std::min(parts, groups / k_resize_chunk_);
+    if (parts <= 1)
+    {
+        map.insert_batch(keys, vals);
+        return map;
+    }
+
+    // partition p owns groups [bounds[p], bounds[p + 1]), the group of a hash is in partition (group * parts) >> shift
+    int shift = __builtin_ctzll(groups);
+    std::vector<size_t> bounds(parts + 1);
+    for (size_t p = 0; p <= parts; p++)
+    {
+        bounds[p] = ((p * groups) + parts - 1) / parts;
+    }
+    auto part_of = [&](size_t hash) { return ((H1(hash) & map.mask_) * parts) >> shift; };
+
+    size_t chunk = (n + parts - 1) / parts;
+    std::vector<size_t> hashes(n);
+    std::vector<size_t> offsets(parts * parts); // offsets[t * parts + p], where chunk t writes in partition p
+    run_threads(parts, [&](size_t t) {
+        size_t *counts = &offsets[t * parts];
+        for (size_t i = t * chunk; i < std::min((t + 1) * chunk, n); i++)
+        {
+            hashes[i] = hash_key(keys[i]);
+            counts[part_of(hashes[i])]++;
+        }
+    });
+
+    // exclusive prefix sum in partition major order, so every partition is one run of order[]
+    std::vector<size_t> part_begin(parts + 1);
+    size_t total = 0;
+    for (size_t p = 0; p < parts; p++)
+    {
+        part_begin[p] = total;
+        for (size_t t = 0; t < parts; t++)
+        {
+            size_t count = offsets[(t * parts) + p];
+            offsets[(t * parts) + p] = total;
+            total += count;
+        }
+    }
+    part_begin[parts] = total;
+
+    std::vector<size_t> order(n);
+    run_threads(parts, [&](size_t t) {
+        size_t *next = &offsets[t * parts];
+        for (size_t i = t * chunk; i < std::min((t + 1) * chunk, n); i++)
+        {
+            order[next[part_of(hashes[i])]++] = i;
+        }
+    });
+
+    std::vector<std::vector<size_t>> spills(parts);
+    std::vector<size_t> filled(parts);
+    run_threads(parts, [&](size_t p) {
+        std::span<const size_t> part{order.data() + part_begin[p], part_begin[p + 1] - part_begin[p]};
+        filled[p] = map.fill_range(keys, vals, part, hashes.data(), bounds[p + 1], spills[p]);
+    });
+    for (size_t count : filled)
+    {
+        map.size_ += count;
+    }
+    map.used_ = map.size_;
+
+    // spills are few, a range only overflows when its last groups are full, and go in input order per partition
+    for (auto &spilled : spills)
+    {
+        for (size_t idx : spilled)
+        {
+            map.insert(keys[idx], vals[idx], hashes[idx]);
+        }
+    }
+    return map;
+}
+
+// threads a scan of this table is split across, at least one and never more than one per k_resize_chunk_ groups
+template <typename K, typename V> size_t hash_map<K, V>::scan_threads(unsigned threads) const
+{
+    size_t runs = threads != 0 ? threads : std::thread::hardware_concurrency();
+    return std::max<size_t>(std::min(runs, groups_ / k_resize_chunk_), 1);
+}
+
+// split the groups into runs contiguous runs and call fn(run, begin, end) for each at once
+template <typename K, typename V> template <typename F> void hash_map<K, V>::for_each_chunk(size_t runs, F &&fn) const
+{
+    size_t chunk = (groups_ + runs - 1) / runs;
+    run_threads(runs, [&](size_t t) { fn(t, std::min(t * chunk, groups_), std::min((t + 1) * chunk, groups_)); });
+}
+
+template <typename K, typename V> template <typename F> void hash_map<K, V>::parallel_for_each(F &&fn, unsigned threads)
+{
+    for_each_chunk(scan_threads(threads), [&](size_t, size_t begin, size_t end) {
+        for (size_t gi = begin; gi < end; gi++)
+        {
+            uint16_t filled = match_filled(ctrls[gi]);
+            while (filled != 0)
+            {
+                fn(slots[(gi * k_group_size_) + __builtin_ctz(filled)].data);
+                filled &= (filled - 1);
+            }
+        }
+    });
+}
+
+template <typename K, typename V>
+template <typename F>
+void hash_map<K, V>::parallel_for_each(F &&fn, unsigned threads) const
+{
+    for_each_chunk(scan_threads(threads), [&](size_t, size_t begin, size_t end) {
+        for (size_t gi = begin; gi < end; gi++)
+        {
+            uint16_t filled = match_filled(ctrls[gi]);
+            while (filled != 0)
+            {
+                fn(std::as_const(slots[(gi * k_group_size_) + __builtin_ctz(filled)].data));
+                filled &= (filled - 1);
+            }
+        }
+    });
+}
+
+// every run folds its own elements with no identity needed, the first element seeds the partial,
+// then the partials are folded into init in run order, so an associative combine_fn gives the same
+// result as a serial fold in iteration order
+template <typename K, typename V>
+template <typename T, typename Map, typename Combine>
+T hash_map<K, V>::parallel_reduce(T init, Map &&map_fn, Combine &&combine_fn, unsigned threads) const
+{
+    std::vector<std::optional<T>> partials(scan_threads(threads));
+    for_each_chunk(partials.size(), [&](size_t t, size_t begin, size_t end) {
+        std::optional<T> &acc = partials[t];
+        for (size_t gi = begin; gi < end; gi++)
+        {
+            uint16_t filled = match_filled(ctrls[gi]);
+            while (filled != 0)
+            {
+                const auto &data = std::as_const(slots[(gi * k_group_size_) + __builtin_ctz(filled)].data);
+                if (acc)
+                {
+                    acc = combine_fn(std::move(*acc), map_fn(data));
+                }
+                else
+                {
+                    acc.emplace(map_fn(data));
+                }
+                filled &= (filled - 1);
             }
-            return;
         }
-        group_idx = (group_idx + 1) & mask_;
+    });
+    for (auto &partial : partials)
+    {
+        if (partial)
+        {
+            init = combine_fn(std::move(init), std::move(*partial));
+        }
     }
+    return init;
 }
 
-template <typename K, typename V> V &hash_map<K, V>::operator[](const K &key)
+// single probe shared by every lookup, returns k_npos_ on a miss
+template <typename K, typename V> template <typename Q> size_t hash_map<K, V>::find_slot(const Q &key, size_t hash) const
 {
-    size_t hash = hash_key(key);
-    // re-size early if an insert would go above load factor
-    // this prevents re-calculating the slot, while only resizing
-    // one value early, which I think is probably a fine trade-off
-    if (used_ + 1 > capacity_ - (capacity_ >> 3))
-    {
-        resize();
-    }
     size_t group_idx = H1(hash) & mask_;
     uint8_t ctrl_byte = H2(hash);
-    size_t ctrl_offset = k_group_size_;
 
     while (true)
     {
@@ -146,14 +1006,14 @@ template <typename K, typename V> V &hash_map<K, V>::operator[](const K &key)
             {
                 if (slots[slot_idx].data.first == key)
                 {
-                    return slots[slot_idx].data.second;
+                    return slot_idx;
                 }
             }
             else
             {
                 if (slots[slot_idx].hash == hash && slots[slot_idx].data.first == key)
                 {
-                    return slots[slot_idx].data.second;
+                    return slot_idx;
                 }
             }
 
@@ -163,69 +1023,99 @@ template <typename K, typename V> V &hash_map<K, V>::operator[](const K &key)
         uint16_t empty_mask = match(group, Empty);
         if (empty_mask != 0)
         {
-            int offset = __builtin_ctz(empty_mask);
-            group[offset] = ctrl_byte;
-            size_t slot_idx = (group_idx * k_group_size_) + offset;
-            if constexpr (Arithmetic<K>)
-            {
-                ::new (&slots[slot_idx]) slot_t{key, {}};
-            }
-            else
-            {
-                ::new (&slots[slot_idx]) slot_t{key, {}, hash};
-            }
-            size_++;
-            used_++;
-            return slots[slot_idx].data.second;
+            return k_npos_;
         }
         group_idx = (group_idx + 1) & mask_;
     }
 }
 
-template <typename K, typename V> std::pair<const K, V> &hash_map<K, V>::at(const K &key) const
+// interleaves the probes of up to k_batch_size_ keys, so the cache misses for their
+// control groups and then their candidate slots are all in flight at the same time
+template <typename K, typename V>
+template <typename F>
+void hash_map<K, V>::find_slots(std::span<const K> keys, F &&on_slot) const
 {
-    size_t hash = hash_key(key);
-    size_t group_idx = H1(hash) & mask_;
-    uint8_t ctrl_byte = H2(hash);
+    size_t hashes[k_batch_size_];
+    size_t groups[k_batch_size_];
+    uint16_t masks[k_batch_size_];
 
-    while (true)
+    for (size_t base = 0; base < keys.size(); base += k_batch_size_)
     {
-        auto &group = ctrls[group_idx];
-        uint16_t ctrl_mask = match(group, ctrl_byte);
+        size_t n = std::min(k_batch_size_, keys.size() - base);
 
-        while (ctrl_mask != 0)
+        // hash every key and prefetch its control group
+        for (size_t i = 0; i < n; i++)
         {
-            int offset = __builtin_ctz(ctrl_mask); // count trailing zeroes, index of first bit that matches
-            size_t slot_idx = (group_idx * k_group_size_) + offset;
+            hashes[i] = hash_key(keys[base + i]);
+            groups[i] = H1(hashes[i]) & mask_;
+            __builtin_prefetch(ctrls[groups[i]]);
+        }
 
-            if constexpr (Arithmetic<K>)
+        // match control bytes and prefetch the first candidate slot
+        for (size_t i = 0; i < n; i++)
+        {
+            masks[i] = match(ctrls[groups[i]], H2(hashes[i]));
+            if (masks[i] != 0)
             {
-                if (slots[slot_idx].data.first == key)
-                {
-                    return slots[slot_idx].data;
-                }
+                __builtin_prefetch(&slots[(groups[i] * k_group_size_) + __builtin_ctz(masks[i])]);
             }
-            else
+        }
+
+        // compare keys, only a key whose home group is full falls back to the full probe
+        for (size_t i = 0; i < n; i++)
+        {
+            const K &key = keys[base + i];
+            size_t found = k_npos_;
+            uint16_t ctrl_mask = masks[i];
+            while (ctrl_mask != 0)
             {
-                if (slots[slot_idx].hash == hash && slots[slot_idx].data.first == key)
+                size_t slot_idx = (groups[i] * k_group_size_) + __builtin_ctz(ctrl_mask);
+                if constexpr (Arithmetic<K>)
+                {
+                    if (slots[slot_idx].data.first == key)
+                    {
+                        found = slot_idx;
+                        break;
+                    }
+                }
+                else
                 {
-                    return slots[slot_idx].data;
+                    if (slots[slot_idx].hash == hashes[i] && slots[slot_idx].data.first == key)
+                    {
+                        found = slot_idx;
+                        break;
+                    }
                 }
+                ctrl_mask &= (ctrl_mask - 1); // clear lowest set bit
             }
-
-            ctrl_mask &= (ctrl_mask - 1); // clear lowest set bit
-        }
-
-        uint16_t empty_mask = match(group, Empty);
-        if (empty_mask != 0)
-        {
-            throw std::out_of_range("Key not found");
+            if (found == k_npos_ && match(ctrls[groups[i]], Empty) == 0)
+            {
+                found = find_slot(key, hashes[i]);
+            }
+            on_slot(base + i, found);
         }
-        group_idx = (group_idx + 1) & mask_;
     }
 }
 
-template <typename K, typename V> bool hash_map<K, V>::contains(const K &key) const
+template <typename K, typename V>
+void hash_map<K, V>::contains_batch(std::span<const K> keys, std::span<bool> out) const
+{
+    find_slots(keys, [&](size_t i, size_t slot_idx) { out[i] = slot_idx != k_npos_; });
+}
+
+template <typename K, typename V> void hash_map<K, V>::find_batch(std::span<const K> keys, std::span<V *> out)
+{
+    find_slots(keys, [&](size_t i, size_t slot_idx) {
+        out[i] = slot_idx == k_npos_ ? nullptr : &slots[slot_idx].data.second;
+    });
+}
+
+// find_slot split at every memory access that is likely to miss, prefetch then suspend so other lookups run
+// while the line is fetched, on_slot turns the slot index, or k_npos_ on a miss, into the task's result
+// on_slot is taken by value so it lives in the coroutine frame, as does key when it is arithmetic
+template <typename K, typename V>
+template <typename R, typename F>
+lookup_task<R> hash_map<K, V>::probe_async(async_key_t key, F on_slot) const
 {
     size_t hash = hash_key(key);
     size_t group_idx = H1(hash) & mask_;
@@ -233,148 +1123,404 @@ template <typename K, typename V> bool hash_map<K, V>::contains(const K &key) co
 
     while (true)
     {
+        __builtin_prefetch(ctrls[group_idx]);
+        co_await std::suspend_always{};
+
         auto &group = ctrls[group_idx];
         uint16_t ctrl_mask = match(group, ctrl_byte);
-
         while (ctrl_mask != 0)
         {
-            int offset = __builtin_ctz(ctrl_mask); // count trailing zeroes, index of first bit that matches
-            size_t slot_idx = (group_idx * k_group_size_) + offset;
+            size_t slot_idx = (group_idx * k_group_size_) + __builtin_ctz(ctrl_mask);
+            __builtin_prefetch(&slots[slot_idx]);
+            co_await std::suspend_always{};
 
             if constexpr (Arithmetic<K>)
             {
                 if (slots[slot_idx].data.first == key)
                 {
-                    return true;
+                    co_return on_slot(slot_idx);
                 }
             }
             else
             {
                 if (slots[slot_idx].hash == hash && slots[slot_idx].data.first == key)
                 {
-                    return true;
+                    co_return on_slot(slot_idx);
                 }
             }
-
-            ctrl_mask &= (ctrl_mask - 1); // clear lowest set bit
+            ctrl_mask &= (ctrl_mask - 1);
         }
 
-        uint16_t empty_mask = match(group, Empty);
-        if (empty_mask != 0)
+        if (match(group, Empty) != 0)
         {
-            return false;
+            co_return on_slot(k_npos_);
         }
         group_idx = (group_idx + 1) & mask_;
     }
 }
 
-template <typename K, typename V> void hash_map<K, V>::erase(const K &key)
+template <typename K, typename V> lookup_task<bool> hash_map<K, V>::contains_async(async_key_t key) const
 {
-    size_t hash = hash_key(key);
-    size_t group_idx = H1(hash) & mask_;
-    uint8_t ctrl_byte = H2(hash);
+    return probe_async<bool>(key, [](size_t slot_idx) { return slot_idx != k_npos_; });
+}
 
-    while (true)
-    {
-        auto &group = ctrls[group_idx];
-        uint16_t ctrl_mask = match(group, ctrl_byte);
+template <typename K, typename V> lookup_task<V *> hash_map<K, V>::get_if_async(async_key_t key)
+{
+    return probe_async<V *>(key, [this](size_t slot_idx) {
+        return slot_idx == k_npos_ ? nullptr : &slots[slot_idx].data.second;
+    });
+}
 
-        while (ctrl_mask != 0)
+template <typename K, typename V> lookup_task<const V *> hash_map<K, V>::get_if_async(async_key_t key) const
+{
+    return probe_async<const V *>(key, [this](size_t slot_idx) -> const V * {
+        return slot_idx == k_npos_ ? nullptr : &slots[slot_idx].data.second;
+    });
+}
+
+template <typename K, typename V>
+lookup_task<std::pair<const K, V> &> hash_map<K, V>::at_async(async_key_t key) const
+{
+    return probe_async<std::pair<const K, V> &>(key, [this](size_t slot_idx) -> std::pair<const K, V> & {
+        if (slot_idx == k_npos_)
         {
-            int offset = __builtin_ctz(ctrl_mask); // count trailing zeroes, index of first bit that matches
-            size_t slot_idx = (group_idx * k_group_size_) + offset;
+            throw std::out_of_range("Key not found");
+        }
+        return slots[slot_idx].data;
+    });
+}
 
-            if constexpr (Arithmetic<K>)
+// round robin over the unfinished tasks, while one waits on its prefetch the others probe
+// tasks the caller already drove to completion are skipped
+template <typename T> void run_interleaved(std::span<lookup_task<T>> tasks)
+{
+    size_t pending = std::ranges::count_if(tasks, [](const lookup_task<T> &task) { return !task.done(); });
+    while (pending != 0)
+    {
+        for (auto &task : tasks)
+        {
+            if (!task.done() && !task.resume())
             {
-                if (slots[slot_idx].data.first == key)
-                {
-                    group[offset] = Tombstone;
-                    size_--;
-                    return;
-                }
+                pending--;
             }
-            else
+        }
+    }
+}
+
+template <typename K, typename V> std::pair<const K, V> &hash_map<K, V>::at(const K &key) const
+{
+    size_t slot_idx = find_slot(key, hash_key(key));
+    if (slot_idx == k_npos_)
+    {
+        throw std::out_of_range("Key not found");
+    }
+    return slots[slot_idx].data;
+}
+
+template <typename K, typename V> bool hash_map<K, V>::contains(const K &key) const
+{
+    return find_slot(key, hash_key(key)) != k_npos_;
+}
+
+template <typename K, typename V> typename hash_map<K, V>::iterator hash_map<K, V>::iterator_at(size_t slot_idx)
+{
+    if (slot_idx == k_npos_)
+    {
+        return end();
+    }
+    // keep only the filled bits from the slot onwards, so incrementing continues the scan
+    size_t group_idx = slot_idx / k_group_size_;
+    uint16_t filled = match_filled(ctrls[group_idx]) & (k_group_mask_ << (slot_idx % k_group_size_));
+    return {this, group_idx, filled};
+}
+
+template <typename K, typename V> typename hash_map<K, V>::iterator hash_map<K, V>::find(const K &key)
+{
+    return iterator_at(find_slot(key, hash_key(key)));
+}
+
+template <typename K, typename V> typename hash_map<K, V>::const_iterator hash_map<K, V>::find(const K &key) const
+{
+    return const_cast<hash_map *>(this)->find(key);
+}
+
+template <typename K, typename V>
+typename hash_map<K, V>::iterator hash_map<K, V>::find(const K &key, size_t hash)
+{
+    return iterator_at(find_slot(key, hash));
+}
+
+template <typename K, typename V>
+typename hash_map<K, V>::const_iterator hash_map<K, V>::find(const K &key, size_t hash) const
+{
+    return const_cast<hash_map *>(this)->find(key, hash);
+}
+
+template <typename K, typename V> V *hash_map<K, V>::get_if(const K &key)
+{
+    size_t slot_idx = find_slot(key, hash_key(key));
+    return slot_idx == k_npos_ ? nullptr : &slots[slot_idx].data.second;
+}
+
+template <typename K, typename V> const V *hash_map<K, V>::get_if(const K &key) const
+{
+    return const_cast<hash_map *>(this)->get_if(key);
+}
+
+// probes only continue past groups with no Empty byte, and a group never regains one until a rehash
+// so a slot in a group that still has an Empty byte can go back to Empty instead of becoming a tombstone
+template <typename K, typename V> void hash_map<K, V>::erase_slot(size_t slot_idx)
+{
+    auto &group = ctrls[slot_idx / k_group_size_];
+    slots[slot_idx].~slot_t();
+    if (match(group, Empty) != 0)
+    {
+        group[slot_idx % k_group_size_] = Empty;
+        used_--;
+    }
+    else
+    {
+        group[slot_idx % k_group_size_] = Tombstone;
+    }
+    size_--;
+}
+
+// one sweep over the control bytes instead of a hash and probe per erased key, tombstones are
+// cleaned up once at the end by rehashing in place if they have taken over a quarter of the table
+template <typename K, typename V> template <typename Pred> size_t hash_map<K, V>::erase_if(Pred &&pred)
+{
+    size_t erased = 0;
+    for (size_t gi = 0; gi < groups_; gi++)
+    {
+        uint16_t filled = match_filled(ctrls[gi]);
+        while (filled != 0)
+        {
+            size_t slot_idx = (gi * k_group_size_) + __builtin_ctz(filled);
+            if (pred(std::as_const(slots[slot_idx].data)))
             {
-                if (slots[slot_idx].hash == hash && slots[slot_idx].data.first == key)
-                {
-                    group[offset] = Tombstone;
-                    size_--;
-                    return;
-                }
+                erase_slot(slot_idx);
+                erased++;
             }
-
-            ctrl_mask &= (ctrl_mask - 1); // clear lowest set bit
+            filled &= (filled - 1);
         }
+    }
+    if (used_ - size_ > (capacity_ >> 2))
+    {
+        resize(groups_);
+    }
+    return erased;
+}
 
-        uint16_t empty_mask = match(group, Empty);
-        if (empty_mask != 0)
+template <typename K, typename V> size_t hash_map<K, V>::erase(const K &key)
+{
+    return erase(key, hash_key(key));
+}
+
+template <typename K, typename V> size_t hash_map<K, V>::erase(const K &key, size_t hash)
+{
+    size_t slot_idx = find_slot(key, hash);
+    if (slot_idx == k_npos_)
+    {
+        return 0;
+    }
+    erase_slot(slot_idx);
+    return 1;
+}
+
+// moves the value out and frees the slot with a single probe
+template <typename K, typename V> std::optional<V> hash_map<K, V>::take(const K &key)
+{
+    size_t slot_idx = find_slot(key, hash_key(key));
+    if (slot_idx == k_npos_)
+    {
+        return std::nullopt;
+    }
+    std::optional<V> val{std::move(slots[slot_idx].data.second)};
+    erase_slot(slot_idx);
+    return val;
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+std::pair<const K, V> &hash_map<K, V>::at(const Q &key) const
+{
+    auto view = as_view(key);
+    size_t slot_idx = find_slot(view, hash_key(view));
+    if (slot_idx == k_npos_)
+    {
+        throw std::out_of_range("Key not found");
+    }
+    return slots[slot_idx].data;
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+bool hash_map<K, V>::contains(const Q &key) const
+{
+    auto view = as_view(key);
+    return find_slot(view, hash_key(view)) != k_npos_;
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+typename hash_map<K, V>::iterator hash_map<K, V>::find(const Q &key)
+{
+    auto view = as_view(key);
+    return iterator_at(find_slot(view, hash_key(view)));
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+typename hash_map<K, V>::const_iterator hash_map<K, V>::find(const Q &key) const
+{
+    return const_cast<hash_map *>(this)->find(key);
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+V *hash_map<K, V>::get_if(const Q &key)
+{
+    auto view = as_view(key);
+    size_t slot_idx = find_slot(view, hash_key(view));
+    return slot_idx == k_npos_ ? nullptr : &slots[slot_idx].data.second;
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+const V *hash_map<K, V>::get_if(const Q &key) const
+{
+    return const_cast<hash_map *>(this)->get_if(key);
+}
+
+template <typename K, typename V>
+template <typename Q>
+    requires Transparent<Q, K>
+size_t hash_map<K, V>::erase(const Q &key)
+{
+    auto view = as_view(key);
+    size_t slot_idx = find_slot(view, hash_key(view));
+    if (slot_idx == k_npos_)
+    {
+        return 0;
+    }
+    erase_slot(slot_idx);
+    return 1;
+}
+
+// arithmetic keys don't store their hash, it is cheap to recompute
+template <typename K, typename V> size_t hash_map<K, V>::slot_hash(const slot_t &slot)
+{
+    if constexpr (Arithmetic<K>)
+    {
+        return hash_key(slot.data.first);
+    }
+    else
+    {
+        return slot.hash;
+    }
+}
+
+// move a slot whose key is known not to be in this table into the first Empty slot of its probe
+// sequence and return where it went, the source slot is destroyed but its control byte is left to the caller
+template <typename K, typename V> size_t hash_map<K, V>::relocate(slot_t &src)
+{
+    size_t hash = slot_hash(src);
+    size_t slot_idx = find_empty(hash);
+    ctrls[slot_idx / k_group_size_][slot_idx % k_group_size_] = H2(hash);
+    ::new (&slots[slot_idx]) slot_t{std::move(src)};
+    src.~slot_t();
+    size_++;
+    used_++;
+    return slot_idx;
+}
+
+// find_empty for resize threads sharing this table, the Empty byte is claimed by CAS so two threads never
+// take the same slot, a lost race moves on to the next Empty byte of the group
+// other threads only ever turn Empty bytes into filled ones, so a stale match() is at worst a failed CAS
+template <typename K, typename V> size_t hash_map<K, V>::claim_empty(size_t hash)
+{
+    size_t group_idx = H1(hash) & mask_;
+    while (true)
+    {
+        uint16_t empty_mask = match(ctrls[group_idx], Empty);
+        while (empty_mask != 0)
         {
-            return;
+            int offset = __builtin_ctz(empty_mask);
+            uint8_t expected = Empty;
+            if (std::atomic_ref<uint8_t>{ctrls[group_idx][offset]}.compare_exchange_strong(expected, H2(hash),
+                                                                                          std::memory_order_relaxed))
+            {
+                return (group_idx * k_group_size_) + offset;
+            }
+            empty_mask &= (empty_mask - 1);
         }
         group_idx = (group_idx + 1) & mask_;
     }
 }
 
-template <typename K, typename V> void hash_map<K, V>::resize()
+// move the filled slots of old groups [begin, end) into this table, safe to run on disjoint ranges at once
+// size_ and used_ are left to the caller, which knows the total once every range is done
+template <typename K, typename V>
+void hash_map<K, V>::relocate_groups(slot_t *old_slots, ctrl_t *old_ctrls, size_t begin, size_t end)
+{
+    for (size_t gi = begin; gi < end; gi++)
+    {
+        uint16_t filled = match_filled(old_ctrls[gi]);
+        while (filled != 0)
+        {
+            slot_t &src = old_slots[(gi * k_group_size_) + __builtin_ctz(filled)];
+            ::new (&slots[claim_empty(slot_hash(src))]) slot_t{std::move(src)};
+            src.~slot_t();
+            filled &= (filled - 1);
+        }
+    }
+}
+
+template <typename K, typename V> void hash_map<K, V>::resize(size_t new_groups)
 {
     size_t old_g = groups_;
     slot_t *old_slots = slots;
     ctrl_t *old_ctrls = ctrls;
 
-    capacity_ *= 2;
-    groups_ *= 2;
+    groups_ = new_groups;
+    capacity_ = k_group_size_ * groups_;
     mask_ = groups_ - 1;
-    slots = new slot_t[capacity_]{};
-    ctrls = new ctrl_t[groups_]{};
-    std::memset(ctrls, Empty, groups_ * k_group_size_);
+    allocate();
 
-    size_ = 0;
-    used_ = 0;
-
-    for (size_t gi = 0; gi < old_g; gi++)
+    size_t threads = policy_.resize_threads != 0 ? policy_.resize_threads : std::thread::hardware_concurrency();
+    threads = std::min(threads, old_g / k_resize_chunk_);
+    if (threads > 1)
     {
-        // loadu_si128 load control bytes into SIMD register
-        // movemask_epi8 extract MSB from 16 bytes into a 16 bit result
-        // ~ bitwise flips so that Filled slots are 1, Empty and Tombstone are 0
-        // &k_group_mask_ keep the 16 filled bits
-        // filled: bitmask where 1 bit indicates filled slot to be re-hashed
-        uint16_t filled = ~_mm_movemask_epi8(_mm_loadu_si128((__m128i *)old_ctrls[gi])) & k_group_mask_;
-        while (filled != 0)
-        {
-            int old_offset = __builtin_ctz(filled);
-            auto slot_data = old_slots[(gi * k_group_size_) + old_offset];
-            size_t hash;
-            if constexpr (Arithmetic<K>)
-            {
-                hash = hash_key(slot_data.data.first);
-            }
-            else
-            {
-                hash = slot_data.hash;
-            }
-            size_t group_idx = H1(hash) & mask_;
-            uint8_t ctrl_byte = H2(hash);
+        // each thread rehashes a contiguous run of old groups
+        size_t chunk = (old_g + threads - 1) / threads;
+        run_threads(threads, [&](size_t t) {
+            relocate_groups(old_slots, old_ctrls, std::min(t * chunk, old_g), std::min((t + 1) * chunk, old_g));
+        });
+        used_ = size_; // every tombstone is dropped
+    }
+    else
+    {
+        size_ = 0;
+        used_ = 0;
 
-            while (true)
+        for (size_t gi = 0; gi < old_g; gi++)
+        {
+            // filled: bitmask where 1 bit indicates filled slot to be re-hashed
+            uint16_t filled = match_filled(old_ctrls[gi]);
+            while (filled != 0)
             {
-                auto &group = ctrls[group_idx];
-                uint16_t empty_mask = match(group, Empty);
-                if (empty_mask != 0)
-                {
-                    int offset = __builtin_ctz(empty_mask);
-                    group[offset] = ctrl_byte;
-                    size_t slot_idx = (group_idx * k_group_size_) + offset;
-                    ::new (&slots[slot_idx]) slot_t{slot_data};
-                    size_++;
-                    used_++;
-                    break;
-                }
-                group_idx = (group_idx + 1) & mask_;
+                int old_offset = __builtin_ctz(filled);
+                relocate(old_slots[(gi * k_group_size_) + old_offset]);
+                filled &= (filled - 1);
             }
-            filled &= (filled - 1);
         }
     }
 
-    delete[] old_slots;
-    delete[] old_ctrls;
+    deallocate(old_slots, old_ctrls, old_g);
 }
@@ -1,14 +1,45 @@
+#pragma once
+#include <coroutine>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string_view>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 enum ctrl : uint8_t
 {                     // use 1 byte int, 0 comparison faster
-    Empty = 0xFF,     // 0b11111111
-    Tombstone = 0xFE, // 0b11111110
-    Sentinel = 0x80   // 0b10000000
-                      // Filled = 0b0xxxxxxx
+    Empty = 0x00,     // 0b00000000, so zeroed pages are already empty tables
+    Tombstone = 0x01, // 0b00000001
+    Sentinel = 0x02,  // 0b00000010
+    Busy = 0x03       // 0b00000011, slot claimed by a concurrent_insert_map writer but not yet published
+                      // Filled = 0b1xxxxxxx
+};
+
+enum class page_policy : uint8_t
+{
+    Standard, // regular heap allocation
+    Huge      // 2MB aligned mapping backed by transparent or explicit huge pages
+};
+
+enum class numa_policy : uint8_t
+{
+    Local,      // first touch placement, the kernel default
+    Interleave, // pages spread round robin across all online nodes
+    Bind        // pages placed on numa_node only
+};
+
+// controls how the slot and control arrays are allocated, applied on construction and on every resize
+struct alloc_policy
+{
+    page_policy pages{page_policy::Standard};
+    numa_policy numa{numa_policy::Local};
+    int numa_node{0};
+    unsigned resize_threads{1}; // threads that rehash on growth, 0 uses every hardware thread
 };
 
 template <typename K>
@@ -20,6 +51,13 @@ concept Container = requires(K key) {
 template <typename K>
 concept Arithmetic = std::is_arithmetic_v<K>;
 
+// lookup types that hash and compare like a Container key without being converted to one
+// e.g. std::string_view or const char * for std::string keys
+template <typename Q, typename K>
+concept Transparent = Container<K> && !std::is_same_v<std::remove_cvref_t<Q>, K> &&
+                      std::is_convertible_v<const K &, std::basic_string_view<typename K::value_type>> &&
+                      std::is_convertible_v<const Q &, std::basic_string_view<typename K::value_type>>;
+
 template <typename K>
 concept Copyable = std::is_trivially_copyable_v<K> && !Arithmetic<K>;
 
@@ -32,6 +70,7 @@ struct slot<const K, V>
 {
     std::pair<const K, V> data;
     slot(const K &key, const V &val) : data{key, val} {}
+    slot(const K &key, V &&val) : data{key, std::move(val)} {}
     slot() : data{} {}
 };
 
@@ -43,17 +82,168 @@ struct slot<K, V>
     std::pair<K, V> data;
     size_t hash;
     slot(const K &key, const V &val, size_t hash) : data{key, val}, hash{hash} {}
+    slot(const K &key, V &&val, size_t hash) : data{key, std::move(val)}, hash{hash} {}
     slot() : data{}, hash{} {}
 };
 
+// key carried together with its hash, so one hash can be reused across lookups and maps
+// only holds a reference, the key must outlive the wrapper
+template <typename K> struct prehashed_key
+{
+    const K &key;
+    size_t hash;
+};
+
+// coroutine frames of lookup_tasks are recycled per thread, a heap allocation per lookup costs about as
+// much as the cache miss the coroutine hides, frames too big for a block go straight to the heap
+struct lookup_frame_pool
+{
+    static constexpr size_t k_frame_bytes_{256};
+    static constexpr size_t k_max_frames_{64}; // enough for any sensible number of lookups in flight
+
+    std::vector<void *> frames;
+    ~lookup_frame_pool()
+    {
+        for (void *frame : frames)
+        {
+            ::operator delete(frame);
+        }
+    }
+
+    static lookup_frame_pool &local()
+    {
+        thread_local lookup_frame_pool pool;
+        return pool;
+    }
+    static void *allocate(size_t bytes)
+    {
+        auto &frames = local().frames;
+        if (bytes > k_frame_bytes_)
+        {
+            return ::operator new(bytes);
+        }
+        if (frames.empty())
+        {
+            return ::operator new(k_frame_bytes_);
+        }
+        void *frame = frames.back();
+        frames.pop_back();
+        return frame;
+    }
+    static void release(void *frame, size_t bytes)
+    {
+        auto &frames = local().frames;
+        if (bytes <= k_frame_bytes_ && frames.size() < k_max_frames_)
+        {
+            frames.push_back(frame);
+            return;
+        }
+        ::operator delete(frame);
+    }
+};
+
+// one lookup as a coroutine, it starts on creation and suspends each time it has prefetched memory it is
+// about to read, resume() runs it to its next suspension, so a caller can overlap many lookups or
+// interleave them with other work, see run_interleaved
+template <typename T> class lookup_task
+{
+    using stored_t = std::conditional_t<std::is_reference_v<T>, std::remove_reference_t<T> *, T>;
+
+  public:
+    struct promise_type
+    {
+        std::optional<stored_t> value;
+        std::exception_ptr error;
+
+        lookup_task get_return_object() { return lookup_task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(T result)
+        {
+            if constexpr (std::is_reference_v<T>)
+            {
+                value.emplace(&result);
+            }
+            else
+            {
+                value.emplace(std::move(result));
+            }
+        }
+        void unhandled_exception() { error = std::current_exception(); }
+
+        static void *operator new(size_t bytes) { return lookup_frame_pool::allocate(bytes); }
+        static void operator delete(void *frame, size_t bytes) { lookup_frame_pool::release(frame, bytes); }
+    };
+
+    lookup_task(lookup_task &&other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+    lookup_task &operator=(lookup_task &&other) noexcept
+    {
+        std::swap(handle_, other.handle_);
+        return *this;
+    }
+    ~lookup_task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    bool done() const { return handle_.done(); }
+    bool resume() // false once the lookup has finished
+    {
+        if (!handle_.done())
+        {
+            handle_.resume();
+        }
+        return !handle_.done();
+    }
+    T get() // only once done(), rethrows what the lookup threw
+    {
+        auto &promise = handle_.promise();
+        if (promise.error)
+        {
+            std::rethrow_exception(promise.error);
+        }
+        if constexpr (std::is_reference_v<T>)
+        {
+            return **promise.value;
+        }
+        else
+        {
+            return std::move(*promise.value);
+        }
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+    explicit lookup_task(std::coroutine_handle<promise_type> handle) : handle_{handle} {}
+};
+
+template <typename T> void run_interleaved(std::span<lookup_task<T>> tasks);
+
+template <typename K, typename V> class optimistic_hash_map;
+template <typename K, typename V> class incremental_hash_map;
+template <typename K, typename V> class concurrent_insert_map;
+template <typename K, typename V> class rcu_hash_map;
+
 template <typename K, typename V> class hash_map
 {
+    friend class optimistic_hash_map<K, V>;   // probes the table directly for lock-free reads
+    friend class incremental_hash_map<K, V>;  // migrates slots between tables group by group
+    friend class concurrent_insert_map<K, V>; // claims slots by CAS on their control byte
+    friend class rcu_hash_map<K, V>;          // shares the default capacity
+
     // constant values
     static constexpr size_t k_group_size_{16};        // size of SIMD register
     static constexpr uint16_t k_group_mask_{0xFFFF};  // 16 bit all set to 1
     static constexpr size_t k_default_capacity_{128}; // default starting capacity
     static constexpr int k_h1_shift_{7};              // least significant 7 bits for control byte
     static constexpr int k_h2_mask_{0x7F};            // most significant x - 7 bits for group index
+    static constexpr uint8_t k_filled_bit_{0x80};     // set on every filled control byte
+    static constexpr size_t k_npos_{~size_t{0}};      // slot index returned on a miss
+    static constexpr size_t k_batch_size_{16};        // keys kept in flight by the batch lookups
+    static constexpr size_t k_resize_chunk_{16384};   // fewest groups worth a thread in the parallel paths
 
     using slot_t = slot<const K, V>;
     using ctrl_t = uint8_t[k_group_size_];
@@ -61,6 +251,9 @@ template <typename K, typename V> class hash_map
     slot_t *slots;
     ctrl_t *ctrls;
 
+    // shared all Empty group for moved-from maps, lookups miss and the first insert allocates
+    alignas(k_group_size_) static inline ctrl_t empty_group_{};
+
     // capacity is linked to groups, because SIMD instructions look at 16
     // bits at a time, groups are size 16, capacity is 16 * groups
     size_t capacity_;
@@ -68,24 +261,214 @@ template <typename K, typename V> class hash_map
     size_t mask_;
     size_t size_{0};
     size_t used_{0};
-    inline size_t hash_key(const K &key) const;
-    void resize();
+    alloc_policy policy_;
+    template <typename Q> static inline size_t hash_key(const Q &key);
+    template <typename Q> size_t find_slot(const Q &key, size_t hash) const;
+    template <typename Q> static auto as_view(const Q &key) { return std::basic_string_view<typename K::value_type>{key}; }
+    template <typename F> void find_slots(std::span<const K> keys, F &&on_slot) const;
+    using async_key_t = std::conditional_t<Arithmetic<K>, K, const K &>;
+    template <typename R, typename F> lookup_task<R> probe_async(async_key_t key, F on_slot) const;
+    void resize(size_t new_groups);
+    static size_t slot_hash(const slot_t &slot);
+    size_t relocate(slot_t &src);
+    size_t find_empty(size_t hash) const;
+    size_t claim_empty(size_t hash);
+    void relocate_groups(slot_t *old_slots, ctrl_t *old_ctrls, size_t begin, size_t end);
+    size_t fill_range(std::span<const K> keys, std::span<const V> vals, std::span<const size_t> order,
+                      const size_t *hashes, size_t group_end, std::vector<size_t> &spills);
+    size_t scan_threads(unsigned threads) const;
+    template <typename F> void for_each_chunk(size_t runs, F &&fn) const;
+    std::pair<size_t, bool> find_or_prepare_insert(const K &key, size_t hash);
+    template <typename Make> void construct(size_t slot_idx, const K &key, Make &&make, size_t hash);
+    void erase_slot(size_t slot_idx);
+    void allocate();
+    void deallocate(slot_t *old_slots, ctrl_t *old_ctrls, size_t old_groups);
+    void destroy_slots();
+    void reset_empty() noexcept;
 
     // utility functions
-    size_t H1(size_t hash) const { return hash >> k_h1_shift_; }
-    size_t H2(size_t hash) const { return hash & k_h2_mask_; }
-    bool at_max_load() const { return used_ > capacity_ - (capacity_ >> 3); }
+    static size_t H1(size_t hash) { return hash >> k_h1_shift_; }
+    static size_t H2(size_t hash) { return (hash & k_h2_mask_) | k_filled_bit_; }
+    static size_t max_load(size_t capacity) { return capacity - (capacity >> 3); } // 87.5% load factor
 
   public:
+    // forward iterator over filled slots, skips whole groups with no filled control bytes
+    template <bool Const> class iter
+    {
+        friend class hash_map;
+        template <bool> friend class iter;
+        using table_t = std::conditional_t<Const, const hash_map, hash_map>;
+
+        table_t *map_{nullptr};
+        size_t group_{0};
+        uint16_t filled_{0}; // filled slots in the current group not yet visited
+
+        iter(table_t *map, size_t group, uint16_t filled) : map_{map}, group_{group}, filled_{filled} {}
+        void skip_empty();
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const K, V>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+
+        iter() = default;
+        template <bool C>
+            requires(Const && !C)
+        iter(const iter<C> &other) : map_{other.map_}, group_{other.group_}, filled_{other.filled_}
+        {
+        }
+
+        reference operator*() const { return map_->slots[(group_ * k_group_size_) + __builtin_ctz(filled_)].data; }
+        pointer operator->() const { return &**this; }
+        iter &operator++()
+        {
+            filled_ &= (filled_ - 1); // clear lowest set bit
+            skip_empty();
+            return *this;
+        }
+        iter operator++(int)
+        {
+            iter prev = *this;
+            ++*this;
+            return prev;
+        }
+        bool operator==(const iter &other) const { return group_ == other.group_ && filled_ == other.filled_; }
+    };
+    using iterator = iter<false>;
+    using const_iterator = iter<true>;
+
+    // an element taken out of a map by extract(), keeps the stored hash so insert() doesn't rehash it
+    class node_type
+    {
+        friend class hash_map;
+        std::optional<slot_t> slot_;
+
+      public:
+        node_type() = default;
+        bool empty() const { return !slot_.has_value(); }
+        explicit operator bool() const { return slot_.has_value(); }
+        const K &key() const { return slot_->data.first; }
+        V &mapped() { return slot_->data.second; }
+    };
+
+  private:
+    iterator iterator_at(size_t slot_idx);
+
+  public:
+
     // constructors
-    hash_map(size_t num_groups = k_default_capacity_);
-    ~hash_map(); // destructor
+    hash_map(size_t num_groups = k_default_capacity_, alloc_policy policy = {});
+    hash_map(const hash_map &other);
+    hash_map(hash_map &&other) noexcept;
+    hash_map &operator=(hash_map other) noexcept; // copy and swap, covers both copy and move assignment
+    ~hash_map();                                  // destructor
+
+    void swap(hash_map &other) noexcept;
+    friend void swap(hash_map &lhs, hash_map &rhs) noexcept { lhs.swap(rhs); }
 
     V &operator[](const K &key);
+    template <typename Make, typename Update> V &upsert(const K &key, Make &&make, Update &&update);
+    template <typename F> V &compute(const K &key, F &&fn);
     void insert(const K &key, const V &val);
-    void erase(const K &key);
+    void insert_batch(std::span<const K> keys, std::span<const V> vals);
+    static hash_map build_parallel(std::span<const K> keys, std::span<const V> vals, unsigned threads = 0,
+                                   alloc_policy policy = {});
+    void reserve(size_t n);
+    size_t erase(const K &key);
+    std::optional<V> take(const K &key);
+    template <typename Pred> size_t erase_if(Pred &&pred);
+    void clear(bool release = false);
+    node_type extract(const K &key);
+    bool insert(node_type &&node);
+    void merge(hash_map &other);
     std::pair<const K, V> &at(const K &key) const;
     bool contains(const K &key) const;
+    iterator find(const K &key);
+    const_iterator find(const K &key) const;
+
+    // precomputed hash overloads, hash must come from hash(key) which is the same for every hash_map<K, *>
+    static size_t hash(const K &key) { return hash_key(key); }
+    static prehashed_key<K> prehash(const K &key) { return {key, hash_key(key)}; }
+    void insert(const K &key, const V &val, size_t hash);
+    void insert(const prehashed_key<K> &key, const V &val) { insert(key.key, val, key.hash); }
+    template <typename Make, typename Update> V &upsert(const K &key, size_t hash, Make &&make, Update &&update);
+    size_t erase(const K &key, size_t hash);
+    size_t erase(const prehashed_key<K> &key) { return erase(key.key, key.hash); }
+    bool contains(const K &key, size_t hash) const { return find_slot(key, hash) != k_npos_; }
+    bool contains(const prehashed_key<K> &key) const { return contains(key.key, key.hash); }
+    iterator find(const K &key, size_t hash);
+    const_iterator find(const K &key, size_t hash) const;
+    iterator find(const prehashed_key<K> &key) { return find(key.key, key.hash); }
+    const_iterator find(const prehashed_key<K> &key) const { return find(key.key, key.hash); }
+
+    // heterogeneous lookup, hashes the same bytes as the equal K so no temporary K is built
+    template <typename Q>
+        requires Transparent<Q, K>
+    static size_t hash(const Q &key)
+    {
+        return hash_key(as_view(key));
+    }
+    template <typename Q>
+        requires Transparent<Q, K>
+    std::pair<const K, V> &at(const Q &key) const;
+    template <typename Q>
+        requires Transparent<Q, K>
+    bool contains(const Q &key) const;
+    template <typename Q>
+        requires Transparent<Q, K>
+    iterator find(const Q &key);
+    template <typename Q>
+        requires Transparent<Q, K>
+    const_iterator find(const Q &key) const;
+    template <typename Q>
+        requires Transparent<Q, K>
+    V *get_if(const Q &key);
+    template <typename Q>
+        requires Transparent<Q, K>
+    const V *get_if(const Q &key) const;
+    template <typename Q>
+        requires Transparent<Q, K>
+    size_t erase(const Q &key);
+    V *get_if(const K &key);
+    const V *get_if(const K &key) const;
+    void contains_batch(std::span<const K> keys, std::span<bool> out) const;
+    void find_batch(std::span<const K> keys, std::span<V *> out);
+
+    // coroutine lookups, each suspends after prefetching its control group and again before reading a slot
+    // arithmetic keys are copied into the task, any other key is held by reference and must outlive it,
+    // so temporaries are rejected, they would die at the end of the call while the task still probes
+    lookup_task<bool> contains_async(async_key_t key) const;
+    lookup_task<V *> get_if_async(async_key_t key);
+    lookup_task<const V *> get_if_async(async_key_t key) const;
+    lookup_task<std::pair<const K, V> &> at_async(async_key_t key) const; // get() throws std::out_of_range on a miss
+    lookup_task<bool> contains_async(K &&key) const
+        requires(!Arithmetic<K>)
+    = delete;
+    lookup_task<V *> get_if_async(K &&key)
+        requires(!Arithmetic<K>)
+    = delete;
+    lookup_task<const V *> get_if_async(K &&key) const
+        requires(!Arithmetic<K>)
+    = delete;
+    lookup_task<std::pair<const K, V> &> at_async(K &&key) const
+        requires(!Arithmetic<K>)
+    = delete;
+
+    // whole table scans split across threads, 0 uses every hardware thread, small tables stay on the caller
+    // fn and map_fn run concurrently on different elements, combine_fn must be associative
+    template <typename F> void parallel_for_each(F &&fn, unsigned threads = 0);
+    template <typename F> void parallel_for_each(F &&fn, unsigned threads = 0) const;
+    template <typename T, typename Map, typename Combine>
+    T parallel_reduce(T init, Map &&map_fn, Combine &&combine_fn, unsigned threads = 0) const;
+
+    iterator begin();
+    const_iterator begin() const;
+    iterator end() { return {this, groups_, 0}; }
+    const_iterator end() const { return {this, groups_, 0}; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
 
     size_t size() const { return size_; }
     size_t used() const { return used_; }
@@ -0,0 +1,176 @@
+#pragma once
+#include "incremental_hash_map.hpp"
+#include "hash_map.cpp"
+#include <stdexcept>
+
+template <typename K, typename V>
+incremental_hash_map<K, V>::incremental_hash_map(size_t num_groups, alloc_policy policy) : table_{num_groups, policy}
+{
+}
+
+// keys are never in both tables, an insert removes the key from old_ first, so slots can be moved
+// straight into the first Empty slot of the new table without probing for a match
+template <typename K, typename V> void incremental_hash_map<K, V>::step()
+{
+    if (!old_)
+    {
+        return;
+    }
+    size_t end = std::min(migrate_group_ + k_migrate_groups_, old_->groups_);
+    for (; migrate_group_ < end; migrate_group_++)
+    {
+        auto &group = old_->ctrls[migrate_group_];
+        uint16_t filled = match_filled(group);
+        while (filled != 0)
+        {
+            int offset = __builtin_ctz(filled);
+            table_.relocate(old_->slots[(migrate_group_ * map_t::k_group_size_) + offset]);
+            group[offset] = Tombstone;
+            old_->size_--;
+            filled &= (filled - 1);
+        }
+    }
+    // release migrated slot pages as we go, freeing a large table in one piece takes milliseconds
+    // control bytes are kept, zeroed pages would read as Empty and cut short probes that start in a
+    // migrated group but end in one that is still waiting
+    char *base = reinterpret_cast<char *>(old_->slots);
+    void *next = table_discard(base + discarded_, old_->slots + (migrate_group_ * map_t::k_group_size_));
+    discarded_ = static_cast<char *>(next) - base;
+    if (migrate_group_ == old_->groups_)
+    {
+        old_.reset();
+    }
+}
+
+// called before an insert, starts a migration instead of letting the table resize itself
+// the new table is twice the size, so it has room for everything left in the old one plus the
+// inserts made before the migration finishes
+template <typename K, typename V> void incremental_hash_map<K, V>::make_room()
+{
+    if (table_.used_ + 1 <= map_t::max_load(table_.capacity_))
+    {
+        return;
+    }
+    finish_migration(); // only reached if a second growth is due before the first completed
+    old_.emplace(std::move(table_));
+    table_ = map_t(old_->groups_ * 2, old_->policy_);
+    migrate_group_ = 0;
+    discarded_ = 0;
+}
+
+template <typename K, typename V> void incremental_hash_map<K, V>::finish_migration()
+{
+    while (old_)
+    {
+        step();
+    }
+}
+
+// a hit in old_ is migrated ahead of its group before its slot is returned, so references handed out by
+// the mutable lookups always point into table_ and only die when table_ itself grows, as with hash_map
+// that is safe for the load factor, the key would have been moved into table_ by step() anyway
+template <typename K, typename V> size_t incremental_hash_map<K, V>::find_slot(const K &key, size_t hash)
+{
+    size_t slot_idx = table_.find_slot(key, hash);
+    if (slot_idx != map_t::k_npos_ || !old_)
+    {
+        return slot_idx;
+    }
+    size_t old_idx = old_->find_slot(key, hash);
+    if (old_idx == map_t::k_npos_)
+    {
+        return map_t::k_npos_;
+    }
+    slot_idx = table_.relocate(old_->slots[old_idx]);
+    old_->ctrls[old_idx / map_t::k_group_size_][old_idx % map_t::k_group_size_] = Tombstone;
+    old_->size_--;
+    return slot_idx;
+}
+
+template <typename K, typename V> V &incremental_hash_map<K, V>::operator[](const K &key)
+{
+    step();
+    size_t hash = map_t::hash_key(key);
+    size_t slot_idx = find_slot(key, hash);
+    if (slot_idx != map_t::k_npos_)
+    {
+        return table_.slots[slot_idx].data.second;
+    }
+    make_room();
+    slot_idx = table_.find_or_prepare_insert(key, hash).first;
+    table_.construct(slot_idx, key, [] { return V{}; }, hash);
+    return table_.slots[slot_idx].data.second;
+}
+
+template <typename K, typename V> void incremental_hash_map<K, V>::insert(const K &key, const V &val)
+{
+    step();
+    size_t hash = map_t::hash_key(key);
+    size_t slot_idx = table_.find_slot(key, hash);
+    if (slot_idx != map_t::k_npos_)
+    {
+        table_.slots[slot_idx].data.second = val;
+        return;
+    }
+    if (old_)
+    {
+        old_->erase(key, hash); // the new value goes in the new table
+    }
+    make_room();
+    table_.insert(key, val, hash);
+}
+
+template <typename K, typename V> size_t incremental_hash_map<K, V>::erase(const K &key)
+{
+    step();
+    size_t hash = map_t::hash_key(key);
+    size_t erased = table_.erase(key, hash);
+    if (old_)
+    {
+        erased += old_->erase(key, hash);
+    }
+    return erased;
+}
+
+template <typename K, typename V> std::pair<const K, V> &incremental_hash_map<K, V>::at(const K &key)
+{
+    size_t slot_idx = find_slot(key, map_t::hash_key(key));
+    if (slot_idx == map_t::k_npos_)
+    {
+        throw std::out_of_range("Key not found");
+    }
+    return table_.slots[slot_idx].data;
+}
+
+// can't migrate the hit, so the reference may point into old_ and only lives until the next mutating call
+template <typename K, typename V>
+const std::pair<const K, V> &incremental_hash_map<K, V>::at(const K &key) const
+{
+    size_t hash = map_t::hash_key(key);
+    size_t slot_idx = table_.find_slot(key, hash);
+    if (slot_idx != map_t::k_npos_)
+    {
+        return table_.slots[slot_idx].data;
+    }
+    if (old_)
+    {
+        slot_idx = old_->find_slot(key, hash);
+        if (slot_idx != map_t::k_npos_)
+        {
+            return old_->slots[slot_idx].data;
+        }
+    }
+    throw std::out_of_range("Key not found");
+}
+
+template <typename K, typename V> bool incremental_hash_map<K, V>::contains(const K &key) const
+{
+    size_t hash = map_t::hash_key(key);
+    return table_.contains(key, hash) || (old_ && old_->contains(key, hash));
+}
+
+template <typename K, typename V> V *incremental_hash_map<K, V>::get_if(const K &key)
+{
+    size_t slot_idx = find_slot(key, map_t::hash_key(key));
+    return slot_idx == map_t::k_npos_ ? nullptr : &table_.slots[slot_idx].data.second;
+}
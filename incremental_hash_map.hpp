@@ -0,0 +1,44 @@
+#pragma once
+#include "hash_map.hpp"
+#include <cstddef>
+#include <optional>
+
+// hash_map that grows without a stop-the-world rehash
+// when the table fills, a table of twice the size is allocated and the old one is kept alongside it,
+// every insert, operator[] and erase then migrates at most k_migrate_groups_ groups of the old table,
+// lookups check the new table and then the old one until the migration is done, operator[], at and get_if
+// move a hit out of the old table first, so what they return is only invalidated when the new table grows,
+// const at can't, and its reference into the old table only lasts until the next mutating call
+template <typename K, typename V> class incremental_hash_map
+{
+    using map_t = hash_map<K, V>;
+
+    static constexpr size_t k_migrate_groups_{8}; // at most 128 slots moved per operation
+
+    map_t table_;
+    std::optional<map_t> old_; // set while a migration is in progress
+    size_t migrate_group_{0};  // next group of old_ to migrate
+    size_t discarded_{0};      // bytes at the start of old_'s slots handed back, an offset so copies stay valid
+
+    void step();
+    void make_room();
+    size_t find_slot(const K &key, size_t hash);
+
+  public:
+    // constructors
+    incremental_hash_map(size_t num_groups = map_t::k_default_capacity_, alloc_policy policy = {});
+
+    V &operator[](const K &key);
+    void insert(const K &key, const V &val);
+    size_t erase(const K &key);
+    std::pair<const K, V> &at(const K &key);
+    const std::pair<const K, V> &at(const K &key) const;
+    bool contains(const K &key) const;
+    V *get_if(const K &key);
+
+    bool migrating() const { return old_.has_value(); }
+    void finish_migration(); // migrate everything left in one go
+
+    size_t size() const { return table_.size() + (old_ ? old_->size() : 0); }
+    size_t capacity() const { return table_.capacity(); }
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include "optimistic_hash_map.hpp"
+#include "hash_map.cpp"
+
+template <typename K, typename V>
+optimistic_hash_map<K, V>::optimistic_hash_map(size_t num_groups, alloc_policy policy)
+    : map_{num_groups, policy}, stripes_{std::make_unique<stripe[]>(k_stripes_)}
+{
+    publish();
+}
+
+template <typename K, typename V> void optimistic_hash_map<K, V>::publish()
+{
+    views_.push_back(std::make_unique<table_view>(table_view{map_.ctrls, map_.slots, map_.mask_}));
+    view_.store(views_.back().get(), std::memory_order_release);
+}
+
+// builds the bigger table off to the side, so the current one is never written while readers probe it
+template <typename K, typename V> void optimistic_hash_map<K, V>::grow()
+{
+    map_t next(map_.groups_ * 2, map_.policy_);
+    for (const auto &[key, val] : map_)
+    {
+        next.insert(key, val);
+    }
+    retired_.push_back(std::move(map_));
+    map_ = std::move(next);
+    publish();
+}
+
+template <typename K, typename V> std::optional<V> optimistic_hash_map<K, V>::get(const K &key) const
+{
+    const table_view *view = view_.load(std::memory_order_acquire);
+    size_t hash = map_t::hash_key(key);
+    size_t group_idx = map_t::H1(hash) & view->mask;
+    uint8_t ctrl_byte = map_t::H2(hash);
+
+    while (true)
+    {
+        const stripe &st = stripes_[group_idx & (k_stripes_ - 1)];
+        uint64_t seq = st.seq.load(std::memory_order_acquire);
+        if ((seq & 1) != 0)
+        {
+            continue; // writer inside this stripe
+        }
+
+        auto &group = view->ctrls[group_idx];
+        uint16_t ctrl_mask = match(group, ctrl_byte);
+        std::optional<V> found;
+        while (ctrl_mask != 0)
+        {
+            const slot_t &slot = view->slots[(group_idx * map_t::k_group_size_) + __builtin_ctz(ctrl_mask)];
+            if constexpr (Arithmetic<K>)
+            {
+                if (slot.data.first == key)
+                {
+                    found.emplace(slot.data.second);
+                    break;
+                }
+            }
+            else
+            {
+                if (slot.hash == hash && slot.data.first == key)
+                {
+                    found.emplace(slot.data.second);
+                    break;
+                }
+            }
+            ctrl_mask &= (ctrl_mask - 1); // clear lowest set bit
+        }
+        bool has_empty = match(group, Empty) != 0;
+
+        // everything read above is discarded unless the stripe is unchanged
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (st.seq.load(std::memory_order_relaxed) != seq)
+        {
+            continue;
+        }
+        if (found || has_empty)
+        {
+            return found;
+        }
+        group_idx = (group_idx + 1) & view->mask;
+    }
+}
+
+// the slot the write lands in is found first, so only that group's stripe is held odd
+template <typename K, typename V> void optimistic_hash_map<K, V>::insert(const K &key, const V &val)
+{
+    std::lock_guard lock{write_lock_};
+    size_t hash = map_t::hash_key(key);
+    size_t slot_idx = map_.find_slot(key, hash);
+    if (slot_idx == map_t::k_npos_)
+    {
+        if (map_.used_ + 1 > map_t::max_load(map_.capacity_))
+        {
+            grow();
+        }
+        slot_idx = map_.find_empty(hash);
+    }
+
+    auto &seq = stripe_of(slot_idx).seq;
+    uint64_t start = seq.load(std::memory_order_relaxed);
+    seq.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    map_.insert(key, val, hash); // lands in slot_idx, and can't resize as room was made above
+    seq.store(start + 2, std::memory_order_release);
+}
+
+template <typename K, typename V> size_t optimistic_hash_map<K, V>::erase(const K &key)
+{
+    std::lock_guard lock{write_lock_};
+    size_t hash = map_t::hash_key(key);
+    size_t slot_idx = map_.find_slot(key, hash);
+    if (slot_idx == map_t::k_npos_)
+    {
+        return 0;
+    }
+
+    auto &seq = stripe_of(slot_idx).seq;
+    uint64_t start = seq.load(std::memory_order_relaxed);
+    seq.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    map_.erase_slot(slot_idx);
+    seq.store(start + 2, std::memory_order_release);
+    return 1;
+}
+
+template <typename K, typename V> size_t optimistic_hash_map<K, V>::size() const
+{
+    std::lock_guard lock{write_lock_};
+    return map_.size();
+}
+
+template <typename K, typename V> void optimistic_hash_map<K, V>::reclaim()
+{
+    std::lock_guard lock{write_lock_};
+    retired_.clear();
+    views_.erase(views_.begin(), views_.end() - 1);
+}
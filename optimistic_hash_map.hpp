@@ -0,0 +1,69 @@
+#pragma once
+#include "hash_map.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+// hash_map for read-mostly workloads, readers take no lock and never write shared memory
+// every group maps to a seqlock stripe, writers serialise on a mutex and make the stripe
+// of the group they write odd for the duration of the write, readers copy the slot out and
+// retry the group if its stripe was odd or changed underneath them
+// a table replaced by growth is retired rather than freed, as readers may still be probing it,
+// retired tables are only freed by reclaim() or the destructor
+template <typename K, typename V> class optimistic_hash_map
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "readers may copy a torn slot before validating it, keys and values must be trivially copyable");
+
+    using map_t = hash_map<K, V>;
+    using slot_t = typename map_t::slot_t;
+    using ctrl_t = typename map_t::ctrl_t;
+
+    static constexpr size_t k_cache_line_{64};
+    static constexpr size_t k_stripes_{1024}; // groups share stripes modulo this
+
+    struct alignas(k_cache_line_) stripe
+    {
+        std::atomic<uint64_t> seq{0}; // odd while a writer is inside a group of this stripe
+    };
+
+    // what readers probe, replaced only when the table grows
+    struct table_view
+    {
+        ctrl_t *ctrls;
+        slot_t *slots;
+        size_t mask;
+    };
+
+    map_t map_;
+    std::unique_ptr<stripe[]> stripes_;
+    std::atomic<const table_view *> view_;
+    std::vector<std::unique_ptr<table_view>> views_; // current and retired views
+    std::vector<map_t> retired_;
+    mutable std::mutex write_lock_;
+
+    stripe &stripe_of(size_t slot_idx) const { return stripes_[(slot_idx / map_t::k_group_size_) & (k_stripes_ - 1)]; }
+    void publish();
+    void grow();
+
+  public:
+    // constructors
+    optimistic_hash_map(size_t num_groups = map_t::k_default_capacity_, alloc_policy policy = {});
+
+    // lock-free readers
+    std::optional<V> get(const K &key) const;
+    bool contains(const K &key) const { return get(key).has_value(); }
+
+    // writers, serialised with each other
+    void insert(const K &key, const V &val);
+    size_t erase(const K &key);
+    size_t size() const;
+
+    // frees tables retired by growth, only safe while no reader is active
+    void reclaim();
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include "rcu_hash_map.hpp"
+#include "hash_map.cpp"
+#include <stdexcept>
+
+// small dense ids for reader slots, an id is handed back when its thread exits so ids stay
+// below the number of live threads, the registry is leaked so threads exiting late can still use it
+inline size_t reader_id()
+{
+    struct registry
+    {
+        std::mutex lock;
+        std::vector<size_t> free;
+        size_t next{0};
+    };
+    static registry &reg = *new registry;
+
+    struct holder
+    {
+        size_t id;
+        holder()
+        {
+            std::lock_guard guard{reg.lock};
+            if (reg.free.empty())
+            {
+                id = reg.next++;
+            }
+            else
+            {
+                id = reg.free.back();
+                reg.free.pop_back();
+            }
+        }
+        ~holder()
+        {
+            std::lock_guard guard{reg.lock};
+            reg.free.push_back(id);
+        }
+    };
+    thread_local holder h;
+    return h.id;
+}
+
+// announce the epoch before loading the pointer, both seq_cst, so a writer that advanced the epoch after
+// swapping the pointer either sees this announcement or this load sees the new pointer
+// a thread that already holds a snapshot is covered by the older announcement and leaves it alone
+template <typename K, typename V>
+rcu_hash_map<K, V>::snapshot::snapshot(const rcu_hash_map &owner) : pin_{nullptr}, overflow_{nullptr}
+{
+    size_t id = reader_id();
+    if (id < k_reader_slots_)
+    {
+        std::atomic<uint64_t> &slot = owner.readers_[id].epoch;
+        if (slot.load(std::memory_order_relaxed) == 0)
+        {
+            slot.store(owner.epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            pin_ = &slot;
+        }
+    }
+    else
+    {
+        overflow_ = &owner.overflow_;
+        overflow_->fetch_add(1, std::memory_order_seq_cst);
+    }
+    map_ = owner.current_.load(std::memory_order_seq_cst);
+}
+
+template <typename K, typename V> rcu_hash_map<K, V>::snapshot::~snapshot()
+{
+    if (pin_)
+    {
+        pin_->store(0, std::memory_order_release);
+    }
+    if (overflow_)
+    {
+        overflow_->fetch_sub(1, std::memory_order_release);
+    }
+}
+
+template <typename K, typename V>
+rcu_hash_map<K, V>::rcu_hash_map(size_t num_groups, alloc_policy policy)
+    : current_{new map_t(num_groups, policy)}, readers_{std::make_unique<reader_slot[]>(k_reader_slots_)}
+{
+}
+
+// no reader may be active once the map is being destroyed
+template <typename K, typename V> rcu_hash_map<K, V>::~rcu_hash_map()
+{
+    for (auto &[map, epoch] : retired_)
+    {
+        delete map;
+    }
+    delete current_.load(std::memory_order_relaxed);
+}
+
+// called with write_lock_ held
+template <typename K, typename V> void rcu_hash_map<K, V>::publish(std::unique_ptr<map_t> next)
+{
+    const map_t *old = current_.exchange(next.release(), std::memory_order_seq_cst);
+    retired_.emplace_back(old, epoch_.fetch_add(1, std::memory_order_seq_cst));
+    reclaim_locked();
+}
+
+template <typename K, typename V> template <typename F> void rcu_hash_map<K, V>::update(F &&fn)
+{
+    std::lock_guard guard{write_lock_};
+    auto next = std::make_unique<map_t>(*current_.load(std::memory_order_relaxed));
+    fn(*next); // if this throws the clone is dropped and nothing is published
+    publish(std::move(next));
+}
+
+template <typename K, typename V> void rcu_hash_map<K, V>::insert(const K &key, const V &val)
+{
+    update([&](map_t &map) { map.insert(key, val); });
+}
+
+template <typename K, typename V> size_t rcu_hash_map<K, V>::erase(const K &key)
+{
+    size_t erased = 0;
+    update([&](map_t &map) { erased = map.erase(key); });
+    return erased;
+}
+
+template <typename K, typename V> void rcu_hash_map<K, V>::reclaim()
+{
+    std::lock_guard guard{write_lock_};
+    reclaim_locked();
+}
+
+// a reader announcing epoch e can only hold snapshots retired in epoch e or later
+template <typename K, typename V> void rcu_hash_map<K, V>::reclaim_locked()
+{
+    if (overflow_.load(std::memory_order_seq_cst) != 0)
+    {
+        return;
+    }
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < k_reader_slots_; i++)
+    {
+        uint64_t epoch = readers_[i].epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0)
+        {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    std::erase_if(retired_, [&](const std::pair<const map_t *, uint64_t> &entry) {
+        if (entry.second < oldest)
+        {
+            delete entry.first;
+            return true;
+        }
+        return false;
+    });
+}
+
+template <typename K, typename V> std::optional<V> rcu_hash_map<K, V>::get(const K &key) const
+{
+    snapshot snap = read();
+    const V *val = snap->get_if(key);
+    return val ? std::optional<V>{*val} : std::nullopt;
+}
+
+template <typename K, typename V> V rcu_hash_map<K, V>::at(const K &key) const
+{
+    return read()->at(key).second;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "hash_map.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// hash_map for tables that change rarely and are read constantly, readers see an immutable snapshot
+// behind an atomic pointer and call plain hash_map lookups on it with no lock and no retry
+// writers clone the current snapshot, change the clone and publish it, serialised on a mutex
+// replaced snapshots are freed by epoch based reclamation: a reader announces the epoch it started in,
+// a snapshot retired in epoch r is freed once no reader is still inside epoch r or earlier
+template <typename K, typename V> class rcu_hash_map
+{
+    using map_t = hash_map<K, V>;
+
+    static constexpr size_t k_cache_line_{64};
+    static constexpr size_t k_reader_slots_{256}; // threads with ids past this share overflow_
+
+    struct alignas(k_cache_line_) reader_slot
+    {
+        std::atomic<uint64_t> epoch{0}; // 0 while the thread holds no snapshot
+    };
+
+    std::atomic<const map_t *> current_;
+    std::atomic<uint64_t> epoch_{1};
+    std::unique_ptr<reader_slot[]> readers_;
+    alignas(k_cache_line_) mutable std::atomic<size_t> overflow_{0}; // readers without a slot, blocks every reclaim
+    std::vector<std::pair<const map_t *, uint64_t>> retired_; // snapshot and the epoch it was retired in
+    mutable std::mutex write_lock_;
+
+    void publish(std::unique_ptr<map_t> next);
+    void reclaim_locked();
+
+  public:
+    // pins the snapshot current when it was taken, only meant to live for the duration of a read
+    class snapshot
+    {
+        friend class rcu_hash_map;
+        const map_t *map_;
+        std::atomic<uint64_t> *pin_; // the slot to clear on release, nullptr for a nested or overflow read
+        std::atomic<size_t> *overflow_;
+        snapshot(const rcu_hash_map &owner);
+
+      public:
+        snapshot(const snapshot &) = delete;
+        snapshot &operator=(const snapshot &) = delete;
+        ~snapshot();
+
+        const map_t &operator*() const { return *map_; }
+        const map_t *operator->() const { return map_; }
+    };
+
+    // constructors
+    rcu_hash_map(size_t num_groups = map_t::k_default_capacity_, alloc_policy policy = {});
+    rcu_hash_map(const rcu_hash_map &) = delete;
+    rcu_hash_map &operator=(const rcu_hash_map &) = delete;
+    ~rcu_hash_map();
+
+    // readers, never blocked by writers or each other
+    snapshot read() const { return snapshot{*this}; }
+    std::optional<V> get(const K &key) const;
+    V at(const K &key) const; // a copy, the snapshot is released on return
+    bool contains(const K &key) const { return read()->contains(key); }
+    size_t size() const { return read()->size(); }
+
+    // writers, each call clones the table once, so batch changes through update
+    template <typename F> void update(F &&fn); // fn(map_t &) on a clone, published once fn returns
+    void insert(const K &key, const V &val);
+    size_t erase(const K &key);
+
+    // frees retired snapshots no reader can still hold, called by every write
+    void reclaim();
+};
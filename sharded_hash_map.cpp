@@ -0,0 +1,171 @@
+#pragma once
+#include "sharded_hash_map.hpp"
+#include "hash_map.cpp"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+template <typename K, typename V, size_t N>
+sharded_hash_map<K, V, N>::sharded_hash_map(size_t groups_per_shard, alloc_policy policy)
+    : shards_{std::make_unique<shard[]>(N)}
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        shards_[i].map = hash_map<K, V>(groups_per_shard, policy);
+    }
+}
+
+template <typename K, typename V, size_t N> void sharded_hash_map<K, V, N>::insert(const K &key, const V &val)
+{
+    size_t hash = hash_map<K, V>::hash(key);
+    shard &s = shards_[shard_of(hash)];
+    std::unique_lock lock{s.lock};
+    s.map.insert(key, val, hash);
+}
+
+template <typename K, typename V, size_t N> V sharded_hash_map<K, V, N>::at(const K &key) const
+{
+    size_t hash = hash_map<K, V>::hash(key);
+    const shard &s = shards_[shard_of(hash)];
+    std::shared_lock lock{s.lock};
+    auto it = s.map.find(key, hash);
+    if (it == s.map.end())
+    {
+        throw std::out_of_range("Key not found");
+    }
+    return it->second;
+}
+
+template <typename K, typename V, size_t N> bool sharded_hash_map<K, V, N>::contains(const K &key) const
+{
+    size_t hash = hash_map<K, V>::hash(key);
+    const shard &s = shards_[shard_of(hash)];
+    std::shared_lock lock{s.lock};
+    return s.map.contains(key, hash);
+}
+
+template <typename K, typename V, size_t N> size_t sharded_hash_map<K, V, N>::erase(const K &key)
+{
+    size_t hash = hash_map<K, V>::hash(key);
+    shard &s = shards_[shard_of(hash)];
+    std::unique_lock lock{s.lock};
+    return s.map.erase(key, hash);
+}
+
+// hash key_at(0) to key_at(count - 1), bucket the key indices by shard with a counting sort,
+// then call fn(shard, indices) once for every shard the batch touches
+template <typename K, typename V, size_t N>
+template <typename KeyAt, typename F>
+void sharded_hash_map<K, V, N>::for_each_shard(size_t count, KeyAt &&key_at, std::span<size_t> hashes, F &&fn) const
+{
+    size_t starts[N + 1]{};
+    for (size_t i = 0; i < count; i++)
+    {
+        hashes[i] = hash_map<K, V>::hash(key_at(i));
+        starts[shard_of(hashes[i]) + 1]++;
+    }
+    for (size_t si = 0; si < N; si++)
+    {
+        starts[si + 1] += starts[si];
+    }
+    std::vector<size_t> order(count);
+    size_t next[N];
+    std::copy(starts, starts + N, next);
+    for (size_t i = 0; i < count; i++)
+    {
+        order[next[shard_of(hashes[i])]++] = i;
+    }
+    for (size_t si = 0; si < N; si++)
+    {
+        if (starts[si] != starts[si + 1])
+        {
+            fn(shards_[si], std::span<const size_t>{order.data() + starts[si], starts[si + 1] - starts[si]});
+        }
+    }
+}
+
+template <typename K, typename V, size_t N>
+void sharded_hash_map<K, V, N>::insert_batch(std::span<const K> keys, std::span<const V> vals)
+{
+    std::vector<size_t> hashes(keys.size());
+    auto key_at = [&](size_t i) -> const K & { return keys[i]; };
+    for_each_shard(keys.size(), key_at, hashes, [&](shard &s, std::span<const size_t> indices) {
+        std::unique_lock lock{s.lock};
+        s.map.reserve(s.map.size() + indices.size());
+        for (size_t i : indices)
+        {
+            s.map.insert(keys[i], vals[i], hashes[i]);
+        }
+    });
+}
+
+template <typename K, typename V, size_t N>
+void sharded_hash_map<K, V, N>::contains_batch(std::span<const K> keys, std::span<bool> out) const
+{
+    std::vector<size_t> hashes(keys.size());
+    auto key_at = [&](size_t i) -> const K & { return keys[i]; };
+    for_each_shard(keys.size(), key_at, hashes, [&](const shard &s, std::span<const size_t> indices) {
+        std::shared_lock lock{s.lock};
+        for (size_t i : indices)
+        {
+            out[i] = s.map.contains(keys[i], hashes[i]);
+        }
+    });
+}
+
+// fold every entry of local in with combine(shared, local) where the key exists, moving it in where it doesn't
+// each shard local touches is locked once, so a thread can pre-aggregate privately and pay for the
+// shared cache lines once per flush instead of once per update
+// if a shard throws, the entries already folded in are erased from local so a retry does not apply them twice
+template <typename K, typename V, size_t N>
+template <typename F>
+void sharded_hash_map<K, V, N>::merge_from(hash_map<K, V> &local, F &&combine)
+{
+    std::vector<std::pair<const K, V> *> entries;
+    entries.reserve(local.size());
+    for (auto &entry : local)
+    {
+        entries.push_back(&entry);
+    }
+    std::vector<size_t> hashes(entries.size());
+    std::vector<bool> merged(entries.size());
+    auto key_at = [&](size_t i) -> const K & { return entries[i]->first; };
+    try
+    {
+        for_each_shard(entries.size(), key_at, hashes, [&](shard &s, std::span<const size_t> indices) {
+            std::unique_lock lock{s.lock};
+            for (size_t i : indices)
+            {
+                V &val = entries[i]->second;
+                s.map.upsert(
+                    entries[i]->first, hashes[i], [&]() -> V && { return std::move(val); },
+                    [&](V &shared) { combine(shared, val); });
+                merged[i] = true;
+            }
+        });
+    }
+    catch (...)
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (merged[i])
+            {
+                local.erase(entries[i]->first, hashes[i]);
+            }
+        }
+        throw;
+    }
+    local.clear();
+}
+
+template <typename K, typename V, size_t N> size_t sharded_hash_map<K, V, N>::size() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        std::shared_lock lock{shards_[i].lock};
+        total += shards_[i].map.size();
+    }
+    return total;
+}
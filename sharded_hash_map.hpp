@@ -0,0 +1,46 @@
+#pragma once
+#include "hash_map.hpp"
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+
+// N independent hash_maps, each behind its own reader-writer lock on its own cache line
+// the shard is chosen from the top bits of the hash, the low bits still pick the group inside the shard
+template <typename K, typename V, size_t N = 64> class sharded_hash_map
+{
+    static_assert(std::has_single_bit(N), "shard count must be a power of two");
+
+    static constexpr size_t k_cache_line_{64};
+    static constexpr int k_shard_bits_{std::countr_zero(N)};
+
+    struct alignas(k_cache_line_) shard
+    {
+        mutable std::shared_mutex lock;
+        hash_map<K, V> map{1}; // replaced with the requested size in the constructor
+    };
+
+    std::unique_ptr<shard[]> shards_;
+
+    static size_t shard_of(size_t hash) { return k_shard_bits_ == 0 ? 0 : hash >> (64 - k_shard_bits_); }
+    template <typename KeyAt, typename F>
+    void for_each_shard(size_t count, KeyAt &&key_at, std::span<size_t> hashes, F &&fn) const;
+
+  public:
+    // constructors
+    sharded_hash_map(size_t groups_per_shard = 16, alloc_policy policy = {});
+
+    void insert(const K &key, const V &val);
+    V at(const K &key) const; // returns a copy, a reference would outlive the shard lock
+    bool contains(const K &key) const;
+    size_t erase(const K &key);
+
+    // each shard is locked once per batch
+    void insert_batch(std::span<const K> keys, std::span<const V> vals);
+    void contains_batch(std::span<const K> keys, std::span<bool> out) const;
+    template <typename F> void merge_from(hash_map<K, V> &local, F &&combine); // empties local
+
+    size_t size() const; // sum of shard sizes, only exact while no writer is active
+    static constexpr size_t shard_count() { return N; }
+};